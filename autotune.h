@@ -0,0 +1,136 @@
+#ifndef __AUTOTUNE_H__
+#define __AUTOTUNE_H__
+
+
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+
+// Picks the fastest of a few configurations by timing short trials on the
+// real population, and remembers the winner in a cache file keyed by
+// machine and workload so later startups can skip the search. A cached
+// winner is only taken if it is still one of the candidates.
+
+
+struct TuneChoice {
+  int backend;
+  float cell_scale; // grid cell size as a multiple of the perception radius
+};
+
+
+inline std::string machine_key() {
+  // hostname, cpu model and core count
+  char host[256] = "unknown";
+  gethostname(host, sizeof(host) - 1);
+
+  std::string model = "unknown";
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(cpuinfo, line)) {
+    if (line.rfind("model name", 0) == 0) {
+      model = line.substr(line.find(':') + 2);
+      break;
+    }
+  }
+
+  std::stringstream key;
+  key << host << '|' << model << '|' << std::thread::hardware_concurrency();
+  return key.str();
+}
+
+
+inline std::string cache_path(const std::string &name) {
+  // name under $XDG_CACHE_HOME or ~/.cache, not wherever we happen to be
+  // started from; empty (so nothing is cached) without either
+  std::filesystem::path dir;
+  if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+    dir = xdg;
+  else if (const char *home = std::getenv("HOME"); home && *home)
+    dir = std::filesystem::path(home) / ".cache";
+  else
+    return "";
+  auto path = dir / name;
+  std::error_code error;
+  std::filesystem::create_directories(path.parent_path(), error);
+  return path.string();
+}
+
+
+class AutoTuner {
+public:
+  AutoTuner(const std::string &path, const std::string &workload)
+    : path(path)
+    , key(machine_key() + '|' + workload) {
+  }
+
+  bool load(const std::vector<TuneChoice> &candidates, TuneChoice &choice) const {
+    // false if there is no entry, or it isn't one of the candidates
+    // (an edited file, or a configuration that is no longer allowed)
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+      if (line.rfind(key + '\t', 0) != 0) continue;
+      std::stringstream values(line.substr(key.size() + 1));
+      TuneChoice cached;
+      if (!(values >> cached.backend >> cached.cell_scale)) continue;
+      for (auto &c: candidates) {
+        if (c.backend == cached.backend && std::abs(c.cell_scale - cached.cell_scale) < 1e-4f) {
+          choice = c;
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  void save(const TuneChoice &choice) const {
+    // keep entries for other machines and workloads
+    std::vector<std::string> lines;
+    {
+      std::ifstream in(path);
+      std::string line;
+      while (std::getline(in, line))
+        if (line.rfind(key + '\t', 0) != 0)
+          lines.push_back(line);
+    }
+    std::ofstream out(path);
+    for (auto &line: lines)
+      out << line << '\n';
+    out << key << '\t' << choice.backend << '\t' << choice.cell_scale << '\n';
+  }
+
+  template <typename F>
+  TuneChoice search(const std::vector<TuneChoice> &candidates, F &&trial) {
+    // trial(choice) returns the time per tick with that configuration
+    TuneChoice best = candidates.front();
+    double best_time = std::numeric_limits<double>::max();
+    for (auto &c: candidates) {
+      double t = trial(c);
+      std::cout << "Autotune backend " << c.backend << "\tcell " << c.cell_scale
+                << "\ttick " << t << std::endl;
+      if (t < best_time) {
+        best_time = t;
+        best = c;
+      }
+    }
+    save(best);
+    return best;
+  }
+
+private:
+  const std::string path;
+  const std::string key;
+};
+
+
+#endif
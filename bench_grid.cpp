@@ -0,0 +1,73 @@
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "grid.h"
+#include "spawn.h"
+
+
+// Keeping the spatial grid current as boids move at increasing speeds
+// (so an increasing share crosses a cell boundary every tick). Every
+// column times the whole of what a tick spends on it, the move pass
+// included:
+//   build    move, copy into the snapshot, full build
+//   rescan   move, copy into the snapshot, update() looking at every boid
+//   flagged  move writing the snapshot and noting crossings, update()
+//            with just those (what boids3 does with GRID_INCREMENTAL)
+// move_ms is the move pass alone, for reference.
+
+
+constexpr int BENCH_BOIDS = 1 << 20;
+constexpr int BENCH_TICKS = 20;
+constexpr float CELL = 0.01;
+
+
+int main() {
+  auto population = spawn_population(2701, BENCH_BOIDS, SpawnConfig());
+
+  std::cout << "speed/cell\trelocated\tmove_ms\tbuild_ms\trescan_ms\tflagged_ms" << std::endl;
+  for (float speed: {0.001f, 0.01f, 0.03f, 0.1f, 0.3f, 0.5f, 1.0f}) {
+    double times[4] = {0.0, 0.0, 0.0, 0.0};
+    uint64_t crossing = 0;
+
+    for (int mode = 0; mode < 4; ++mode) {
+      auto pos = population.pos;
+      std::vector<glm::vec2> snapshot = pos;
+      Grid grid(-1.0f, 1.0f, CELL, 1 << 30); // no periodic compaction in here
+      grid.build(pos);
+      Crossings crossings;
+
+      for (int t = 0; t < BENCH_TICKS; ++t) {
+        auto start = std::chrono::steady_clock::now();
+        auto &crossed = crossings.local();
+        for (int i = 0; i < BENCH_BOIDS; ++i) {
+          pos[i] += speed*CELL*population.vel[i];
+          pos[i] = glm::clamp(pos[i], -1.0f, 1.0f);
+          if (mode == 3 && grid.moved_out(i, pos[i]))
+            crossed.push_back(i);
+        }
+
+        if (mode == 1) {
+          snapshot = pos;
+          grid.build(snapshot);
+        } else if (mode == 2) {
+          snapshot = pos;
+          grid.update(snapshot);
+        } else if (mode == 3) {
+          crossing += grid.update(pos, crossings.collect());
+        }
+        times[mode] += std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now() - start).count();
+      }
+    }
+
+    std::cout << speed << '\t'
+              << static_cast<double>(crossing)/BENCH_TICKS/BENCH_BOIDS << '\t'
+              << times[0]/BENCH_TICKS << '\t' << times[1]/BENCH_TICKS << '\t'
+              << times[2]/BENCH_TICKS << '\t' << times[3]/BENCH_TICKS << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,139 @@
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "grid.h"
+#include "world.h"
+
+
+// How far multi rate steering (MULTI_RATE in boids3) moves the flock from
+// the full rules. The same seeds run both ways, with boids3's parameters
+// and density, and at every checkpoint polarization and the exact mean
+// neighbour count within the sense radius are taken from the positions,
+// not from the cached counts. A single seed says little: the reference
+// alone ranges over most of [0, 1] in polarization between seeds, so the
+// ensemble mean of each and the mean of the per seed differences are
+// printed, with their standard errors.
+
+
+constexpr int BENCH_BOIDS = 8192;
+constexpr int BENCH_TICKS = 300;
+constexpr int BENCH_SEEDS = 24;
+constexpr int CHECK_EVERY = 50;
+
+constexpr float NEAR_SENSE_RAD = 0.05;
+constexpr uint32_t SLOW_EVERY = 4;
+
+
+struct Sample {
+  double polarization;
+  double neighbours;
+};
+
+
+Sample measure(const World &world) {
+  glm::vec2 heading(0.0f);
+  for (auto v: world.vel)
+    heading += glm::normalize(v);
+
+  float r = world.p.sense_rad;
+  Grid grid(-1.0f, 1.0f, r);
+  grid.build(world.pos);
+  uint64_t pairs = 0;
+  for (auto p: world.pos)
+    grid.for_each_near(p, [&](uint32_t j) {
+      glm::vec2 d = world.pos[j] - p;
+      pairs += glm::dot(d, d) < r*r;
+    });
+  double n = world.pos.size();
+  return Sample{glm::length(heading)/n, (pairs - n)/n}; // minus ourselves
+}
+
+
+struct Band {
+  double mean;
+  double se;
+};
+
+
+Band band(const std::vector<double> &xs) {
+  double mean = 0.0, var = 0.0;
+  for (auto x: xs) mean += x;
+  mean /= xs.size();
+  for (auto x: xs) var += (x - mean)*(x - mean);
+  var /= xs.size() - 1;
+  return Band{mean, std::sqrt(var/xs.size())};
+}
+
+
+std::ostream &operator<<(std::ostream &out, const Band &b) {
+  return out << b.mean << " +- " << b.se;
+}
+
+
+int main() {
+  constexpr int checks = BENCH_TICKS/CHECK_EVERY;
+  // [seed][check][full, multi rate]
+  std::vector<std::array<std::array<Sample, 2>, checks>> samples(BENCH_SEEDS);
+  double times[2] = {0.0, 0.0};
+  std::mutex times_mutex;
+
+  std::atomic<int> next {0};
+  auto worker = [&] {
+    for (int s = next++; s < BENCH_SEEDS; s = next++) {
+      for (int multi = 0; multi < 2; ++multi) {
+        World world(Params{0.1, 0.002, 0.02, 0.03, static_cast<uint64_t>(s + 1)}, BENCH_BOIDS);
+        if (multi)
+          world.set_multi_rate(NEAR_SENSE_RAD, SLOW_EVERY);
+        double elapsed = 0.0;
+        for (int t = 0; t < BENCH_TICKS; ++t) {
+          auto start = std::chrono::steady_clock::now();
+          world.tick();
+          elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+          if ((t + 1) % CHECK_EVERY == 0)
+            samples[s][t/CHECK_EVERY][multi] = measure(world);
+        }
+        std::scoped_lock lock(times_mutex);
+        times[multi] += elapsed;
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < std::max(std::thread::hardware_concurrency(), 1u); ++i)
+    threads.emplace_back(worker);
+  for (auto &t: threads)
+    t.join();
+
+  std::cout << std::fixed << std::setprecision(3);
+  std::cout << "tick\tfull_polarization\tmulti_polarization\tdifference"
+            << "\tfull_neighbours\tmulti_neighbours\tdifference" << std::endl;
+  for (int c = 0; c < checks; ++c) {
+    std::vector<double> fp, mp, dp, fn, mn, dn;
+    for (auto &seed: samples) {
+      auto &[full, multi] = seed[c];
+      fp.push_back(full.polarization);
+      mp.push_back(multi.polarization);
+      dp.push_back(multi.polarization - full.polarization);
+      fn.push_back(full.neighbours);
+      mn.push_back(multi.neighbours);
+      dn.push_back(multi.neighbours - full.neighbours);
+    }
+    std::cout << (c + 1)*CHECK_EVERY << '\t' << band(fp) << '\t' << band(mp) << '\t' << band(dp)
+              << '\t' << band(fn) << '\t' << band(mn) << '\t' << band(dn) << std::endl;
+  }
+
+  double ticks = static_cast<double>(BENCH_SEEDS)*BENCH_TICKS;
+  std::cout << "ms per tick: full " << 1000.0*times[0]/ticks
+            << " multi rate " << 1000.0*times[1]/ticks << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "glad/glad.h"
+
+#include "glm/glm.hpp"
+
+#include "renderring.h"
+#include "shader.cpp"
+#include "spawn.h"
+
+
+// Getting boid positions to the gpu the two ways boids3 can, without a
+// window: the copy path (interpolated on the cpu out of the previous and
+// next tick, uploaded every frame) and the persistent ring (renderring.h).
+// A simulation thread publishes a tick every LOGIC_DT while the main
+// thread draws into an offscreen framebuffer, on a surfaceless EGL
+// context, as fast as it can. Per path it prints the cpu time per frame
+// spent feeding positions, the time per tick spent publishing them (mean
+// and worst, the part that counts against the logic tick's budget, and
+// the worst wait for a ring slot on its own), and the ticks the ring had
+// no free slot for.
+
+
+constexpr int BENCH_BOIDS = 1 << 20;
+constexpr double BENCH_SECONDS = 3.0;
+constexpr double LOGIC_DT = 1.0/60.0;
+constexpr int WIDTH = 640;
+constexpr int HEIGHT = 480;
+
+
+using Clock = std::chrono::steady_clock;
+
+double since(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+
+bool make_context() {
+  // surfaceless, so it runs on machines without a display
+  EGLDisplay display = eglGetPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+                                             EGL_DEFAULT_DISPLAY, nullptr);
+  if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr)) {
+    std::cerr << "No EGL display" << std::endl;
+    return false;
+  }
+  eglBindAPI(EGL_OPENGL_API);
+
+  EGLint config_attribs[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+  EGLConfig config;
+  EGLint num_configs = 0;
+  eglChooseConfig(display, config_attribs, &config, 1, &num_configs);
+
+  EGLint context_attribs[] = {
+    EGL_CONTEXT_MAJOR_VERSION, 4,
+    EGL_CONTEXT_MINOR_VERSION, 4,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+    EGL_NONE
+  };
+  EGLContext context = eglCreateContext(display, num_configs > 0 ? config : EGL_NO_CONFIG_KHR,
+                                        EGL_NO_CONTEXT, context_attribs);
+  if (context == EGL_NO_CONTEXT
+      || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+    std::cerr << "No OpenGL 4.4 context" << std::endl;
+    return false;
+  }
+  if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress)) {
+    std::cerr << "Failed to initialize GLAD" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+
+struct Result {
+  int frames = 0;
+  int ticks = 0;
+  double feed = 0.0; // seconds, summed over frames
+  double publish = 0.0; // seconds, summed over ticks
+  double worst_publish = 0.0;
+  double worst_acquire = 0.0;
+  uint64_t not_shown = 0;
+};
+
+
+Result run(bool use_ring, const std::vector<glm::vec2> &start_pos,
+           const std::vector<glm::vec2> &start_vel) {
+  PositionRing ring;
+  if (use_ring && !ring.create(BENCH_BOIDS)) {
+    std::cerr << "No buffer storage, skipping the ring" << std::endl;
+    return Result();
+  }
+
+  GLuint shader = load_shaders(use_ring);
+  GLint alpha_uniform = glGetUniformLocation(shader, "alpha");
+
+  GLuint vao, vbo;
+  glGenVertexArrays(1, &vao);
+  glBindVertexArray(vao);
+  glGenBuffers(1, &vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec2)*BENCH_BOIDS, nullptr, GL_DYNAMIC_DRAW);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void *)0);
+  if (use_ring)
+    glEnableVertexAttribArray(1);
+
+  // the copy path's previous and next tick, under the mutex
+  std::mutex mutex;
+  std::vector<glm::vec2> prev = start_pos, next = start_pos;
+  std::vector<glm::vec2> boid_buffer(BENCH_BOIDS);
+  double next_tick_time = 0.0;
+
+  Result result;
+  std::atomic<bool> running {true};
+  auto bench_start = Clock::now();
+
+  std::thread simulation([&] {
+    auto pos = start_pos;
+    auto vel = start_vel;
+    for (int tick = 1; running.load(); ++tick) {
+      for (int i = 0; i < BENCH_BOIDS; ++i) {
+        pos[i] += 0.001f*vel[i];
+        if (std::abs(pos[i].x) > 1.0f) vel[i].x = -vel[i].x;
+        if (std::abs(pos[i].y) > 1.0f) vel[i].y = -vel[i].y;
+      }
+
+      auto publish_start = Clock::now();
+      glm::vec2 *slot = use_ring ? ring.acquire() : nullptr;
+      result.worst_acquire = std::max(result.worst_acquire, since(publish_start));
+      if (slot)
+        std::copy(pos.begin(), pos.end(), slot);
+      {
+        std::scoped_lock lock(mutex);
+        if (slot) {
+          ring.publish();
+          next_tick_time = since(bench_start);
+        } else if (!use_ring) {
+          prev.swap(next);
+          next = pos;
+          next_tick_time = since(bench_start);
+        }
+      }
+      double publish = since(publish_start);
+      result.publish += publish;
+      result.worst_publish = std::max(result.worst_publish, publish);
+      ++result.ticks;
+
+      std::this_thread::sleep_until(bench_start + std::chrono::duration<double>(tick*LOGIC_DT));
+    }
+  });
+
+  while (since(bench_start) < BENCH_SECONDS) {
+    auto feed_start = Clock::now();
+    bool have_frame = true;
+    GLintptr prev_offset = 0, next_offset = 0;
+    float alpha;
+    {
+      std::scoped_lock lock(mutex);
+      alpha = (since(bench_start) - next_tick_time)/LOGIC_DT;
+      if (use_ring) {
+        have_frame = ring.begin_frame(prev_offset, next_offset);
+      } else {
+        for (int i = 0; i < BENCH_BOIDS; ++i)
+          boid_buffer[i] = glm::mix(prev[i], next[i], alpha);
+      }
+    }
+
+    glUseProgram(shader);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glBindVertexArray(vao);
+    if (use_ring) {
+      glBindBuffer(GL_ARRAY_BUFFER, ring.get_buffer());
+      glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void *)prev_offset);
+      glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void *)next_offset);
+      glUniform1f(alpha_uniform, alpha);
+    } else {
+      glBindBuffer(GL_ARRAY_BUFFER, vbo);
+      glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glm::vec2)*BENCH_BOIDS, boid_buffer.data());
+    }
+    result.feed += since(feed_start);
+
+    if (have_frame) {
+      glDrawArrays(GL_POINTS, 0, BENCH_BOIDS);
+      if (use_ring)
+        ring.end_frame();
+    }
+    glFlush(); // like a swap, without waiting for the gpu to finish
+    ++result.frames;
+  }
+
+  running = false;
+  simulation.join();
+  glFinish();
+
+  if (use_ring) {
+    result.not_shown = ring.get_skipped();
+    ring.destroy();
+  }
+  glDeleteVertexArrays(1, &vao);
+  glDeleteBuffers(1, &vbo);
+  glDeleteProgram(shader);
+  return result;
+}
+
+
+int main() {
+  if (!make_context())
+    return 1;
+  std::cout << "Renderer: " << glGetString(GL_RENDERER) << std::endl;
+
+  GLuint fbo, colour;
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glGenRenderbuffers(1, &colour);
+  glBindRenderbuffer(GL_RENDERBUFFER, colour);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, WIDTH, HEIGHT);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colour);
+  glViewport(0, 0, WIDTH, HEIGHT);
+
+  auto population = spawn_population(2701, BENCH_BOIDS, SpawnConfig());
+
+  std::cout << "path\tframes\tfeed_ms\tticks\tpublish_ms\tworst_publish_ms\tworst_acquire_ms\tnot_shown" << std::endl;
+  for (bool use_ring: {false, true}) {
+    auto r = run(use_ring, population.pos, population.vel);
+    if (r.frames == 0) continue;
+    std::cout << (use_ring ? "ring" : "copy") << '\t' << r.frames << '\t'
+              << 1000.0*r.feed/r.frames << '\t' << r.ticks << '\t'
+              << 1000.0*r.publish/std::max(r.ticks, 1) << '\t'
+              << 1000.0*r.worst_publish << '\t' << 1000.0*r.worst_acquire << '\t' << r.not_shown << std::endl;
+  }
+
+  glDeleteRenderbuffers(1, &colour);
+  glDeleteFramebuffers(1, &fbo);
+  return 0;
+}
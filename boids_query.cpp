@@ -0,0 +1,64 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "shmstate.h"
+
+
+// Reads the ticks boids3 publishes to shared memory. Prints the tick and
+// the boids within radius r of (x, y), a few times a second, until
+// boids3 exits.
+//
+//   boids_query [x y r] [name]
+
+
+int main(int argc, char **argv) {
+  glm::vec2 p(0.0f);
+  float r = 0.1f;
+  std::string name = "/boids3";
+  if (argc >= 4) {
+    p = glm::vec2(std::atof(argv[1]), std::atof(argv[2]));
+    r = std::atof(argv[3]);
+  }
+  if (argc >= 5)
+    name = argv[4];
+
+  ShmReader reader(name);
+  if (!reader.good()) {
+    std::cerr << "Could not open shared memory " << name
+              << ", is boids3 running?" << std::endl;
+    return 1;
+  }
+  if (!reader.writer_alive()) {
+    std::cerr << "Shared memory " << name << " was left behind by a boids3 that"
+              << " is no longer running" << std::endl;
+    return 1;
+  }
+
+  std::vector<uint32_t> near;
+  std::vector<glm::vec2> pos, vel;
+  uint64_t last = SHM_NO_TICK; // nothing to show until the first publish
+  while (reader.writer_alive()) {
+    uint64_t tick = reader.snapshot(pos, vel);
+    // the two views have to come from the same tick
+    if (tick != last && reader.query(p, r, near) == tick) {
+      glm::vec2 heading(0.0f);
+      for (uint32_t i: near)
+        heading += vel[i];
+      std::cout << "tick\t" << tick << "\tboids\t" << pos.size()
+                << "\tnear\t" << near.size();
+      if (!near.empty())
+        std::cout << "\theading\t" << heading.x/near.size() << ' ' << heading.y/near.size();
+      std::cout << std::endl;
+      last = tick;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  }
+  std::cerr << "boids3 is no longer running" << std::endl;
+  return 0;
+}
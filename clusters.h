@@ -0,0 +1,249 @@
+#ifndef __CLUSTERS_H__
+#define __CLUSTERS_H__
+
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "grid.h"
+#include "pool.h"
+#include "sparsegrid.h"
+
+
+// Flock identification: connected components of the "within radius"
+// graph, found with a lock-free union-find. Neighbours are looked up in a
+// grid the caller already has (the tick's spatial index, normally), and
+// every phase is split over a persistent Pool, so a call never builds a
+// grid or starts threads of its own.
+//
+// pos and vel are vectors of anything with position_of() and
+// velocity_of() overloads respectively.
+
+
+struct Cluster {
+  uint32_t size;
+  glm::vec2 centroid;
+  glm::vec2 velocity; // mean velocity
+};
+
+
+struct Clusters {
+  std::vector<uint32_t> label; // cluster index of every boid
+  std::vector<Cluster> clusters;
+};
+
+
+class UnionFind {
+public:
+  explicit UnionFind(uint32_t n)
+    : parent(n) {
+    for (uint32_t i = 0; i < n; ++i)
+      parent[i].store(i, std::memory_order_relaxed);
+  }
+
+  uint32_t find(uint32_t x) {
+    // path halving, a lost race just means a bit less compression
+    while (true) {
+      uint32_t p = parent[x].load(std::memory_order_relaxed);
+      if (p == x) return x;
+      uint32_t gp = parent[p].load(std::memory_order_relaxed);
+      if (gp != p)
+        parent[x].compare_exchange_weak(p, gp, std::memory_order_relaxed);
+      x = gp;
+    }
+  }
+
+  void unite(uint32_t a, uint32_t b) {
+    // always hang the larger root under the smaller one
+    while (true) {
+      a = find(a);
+      b = find(b);
+      if (a == b) return;
+      if (a < b) std::swap(a, b);
+      uint32_t expected = a;
+      if (parent[a].compare_exchange_strong(expected, b, std::memory_order_acq_rel))
+        return;
+    }
+  }
+
+private:
+  std::vector<std::atomic<uint32_t>> parent;
+};
+
+
+template <typename P, typename V, typename Index>
+Clusters find_clusters(const std::vector<P> &pos, const std::vector<V> &vel,
+                       float radius, const Index &index, Pool &pool) {
+  // index is any grid already built over pos with cells at least radius
+  // wide, Grid and SparseGrid both do
+  uint32_t n = pos.size();
+  Clusters result;
+  if (n == 0) return result;
+
+  // link everything within radius. First every cell with itself, noting
+  // the cells that came out as one piece; then every pair of neighbouring
+  // cells once, where one link is all it takes to join a cell that is in
+  // one piece, which in the middle of a flock is nearly all of them.
+  UnionFind uf(n);
+  float r2 = radius*radius;
+  auto close = [&](uint32_t i, uint32_t j) {
+    glm::vec2 d = position_of(pos[j]) - position_of(pos[i]);
+    return glm::dot(d, d) < r2;
+  };
+
+  uint32_t num_cells = index.num_cells();
+  std::vector<uint32_t> first(num_cells); // some boid of every cell
+  std::vector<uint8_t> whole(num_cells); // all its boids already linked
+  pool.for_range(num_cells, [&](uint32_t c0, uint32_t c1) {
+    std::vector<uint32_t> members;
+    for (uint32_t c = c0; c < c1; ++c) {
+      members.clear();
+      index.for_each_in(c, [&](uint32_t i) { members.push_back(i); });
+      if (members.empty()) continue;
+      for (size_t a = 0; a < members.size(); ++a)
+        for (size_t b = a + 1; b < members.size(); ++b)
+          if (close(members[a], members[b])) uf.unite(members[a], members[b]);
+      // roots only ever merge, so a shared root here stays shared
+      uint32_t root = uf.find(members[0]);
+      first[c] = members[0];
+      whole[c] = std::all_of(members.begin() + 1, members.end(),
+                             [&](uint32_t i) { return uf.find(i) == root; });
+    }
+  });
+
+  pool.for_range(num_cells, [&](uint32_t c0, uint32_t c1) {
+    std::vector<uint32_t> members;
+    for (uint32_t c = c0; c < c1; ++c) {
+      if (index.count_in(c) == 0) continue;
+      index.for_each_cell_near(c, [&](uint32_t other) {
+        if (other <= c || index.count_in(other) == 0) return;
+        if (whole[c] && whole[other] && uf.find(first[c]) == uf.find(first[other]))
+          return;
+        // walk the boids of a cell in one piece on the inside,
+        // it's done with as soon as one of them links
+        uint32_t outer = whole[c] ? other : c, inner = whole[c] ? c : other;
+        members.clear();
+        index.for_each_in(inner, [&](uint32_t j) { members.push_back(j); });
+        bool linked = false;
+        index.for_each_in(outer, [&](uint32_t i) {
+          if (linked && whole[outer]) return;
+          for (uint32_t j: members) {
+            if (close(i, j)) {
+              uf.unite(i, j);
+              linked = true;
+              if (whole[inner]) break;
+            }
+          }
+        });
+      });
+    }
+  });
+
+  // flatten to roots, every root is the lowest index of its cluster
+  result.label.resize(n);
+  pool.for_range(n, [&](uint32_t i0, uint32_t i1) {
+    for (uint32_t i = i0; i < i1; ++i)
+      result.label[i] = uf.find(i);
+  });
+
+  // number the roots densely, in index order: count per thread,
+  // then every thread numbers its own from its offset
+  unsigned threads = pool.size();
+  uint32_t chunk = (n + threads - 1)/threads;
+  auto range = [&](unsigned t) {
+    uint32_t i0 = std::min<uint64_t>(uint64_t(t)*chunk, n);
+    return std::make_pair(i0, std::min<uint64_t>(uint64_t(i0) + chunk, n));
+  };
+  std::vector<uint32_t> offset(threads + 1, 0);
+  pool.run([&](unsigned t) {
+    auto [i0, i1] = range(t);
+    for (uint32_t i = i0; i < i1; ++i)
+      offset[t + 1] += result.label[i] == i;
+  });
+  for (unsigned t = 0; t < threads; ++t)
+    offset[t + 1] += offset[t];
+  uint32_t num_clusters = offset[threads];
+
+  std::vector<uint32_t> number(n);
+  pool.run([&](unsigned t) {
+    auto [i0, i1] = range(t);
+    uint32_t next = offset[t];
+    for (uint32_t i = i0; i < i1; ++i)
+      if (result.label[i] == i) number[i] = next++;
+  });
+
+  // relabel, then sort the boids by cluster (counting sort), so that
+  // every cluster is one run of order starting at start[c]
+  pool.for_range(n, [&](uint32_t i0, uint32_t i1) {
+    for (uint32_t i = i0; i < i1; ++i)
+      result.label[i] = number[result.label[i]];
+  });
+  std::vector<uint32_t> start(num_clusters + 1, 0);
+  for (uint32_t i = 0; i < n; ++i)
+    ++start[result.label[i] + 1];
+  for (uint32_t c = 0; c < num_clusters; ++c)
+    start[c + 1] += start[c];
+  std::vector<uint32_t> order(n);
+  std::copy(start.begin(), start.end() - 1, number.begin()); // free by now, reused as cursors
+  for (uint32_t i = 0; i < n; ++i)
+    order[number[result.label[i]]++] = i;
+
+  // sum up the runs, every thread over an even share of order; the
+  // runs cut by a thread's bounds (two at most) are summed in pieces
+  // and put together afterwards, all others belong to one thread only
+  result.clusters.assign(num_clusters, Cluster{0, glm::vec2(0.0f), glm::vec2(0.0f)});
+  std::vector<std::pair<uint32_t, Cluster>> pieces(2*threads, {0, Cluster{0, glm::vec2(0.0f), glm::vec2(0.0f)}});
+  pool.run([&](unsigned t) {
+    auto [k0, k1] = range(t);
+    for (uint32_t k = k0; k < k1;) {
+      uint32_t c = result.label[order[k]];
+      uint32_t end = std::min<uint32_t>(start[c + 1], k1);
+      Cluster sum {end - k, glm::vec2(0.0f), glm::vec2(0.0f)};
+      for (; k < end; ++k) {
+        sum.centroid += position_of(pos[order[k]]);
+        sum.velocity += velocity_of(vel[order[k]]);
+      }
+      if (start[c] < k0)
+        pieces[2*t] = {c, sum};
+      else if (start[c + 1] > k1)
+        pieces[2*t + 1] = {c, sum};
+      else
+        result.clusters[c] = sum;
+    }
+  });
+  for (auto &[c, piece]: pieces) {
+    result.clusters[c].size += piece.size;
+    result.clusters[c].centroid += piece.centroid;
+    result.clusters[c].velocity += piece.velocity;
+  }
+
+  pool.for_range(num_clusters, [&](uint32_t c0, uint32_t c1) {
+    for (uint32_t c = c0; c < c1; ++c) {
+      auto &cl = result.clusters[c];
+      cl.centroid /= static_cast<float>(cl.size);
+      cl.velocity /= static_cast<float>(cl.size);
+    }
+  });
+
+  return result;
+}
+
+
+template <typename P, typename V>
+Clusters find_clusters(const std::vector<P> &pos, const std::vector<V> &vel,
+                       float radius, Pool &pool) {
+  // for callers without a grid of their own, sparse so it
+  // doesn't care how far apart the boids are
+  SparseGrid grid(radius);
+  grid.build(pos);
+  return find_clusters(pos, vel, radius, grid, pool);
+}
+
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef __CONTACTS_H__
+#define __CONTACTS_H__
+
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include "perthread.h"
+
+
+// Enter and leave events between pairs of boids, found by merging each
+// boid's sorted neighbour ids against last tick's. Workers append to
+// their own buffer (a PerThread, like FlockStats), the main
+// thread collects those once per tick, and a background thread hands the
+// batches to the consumer, so a slow consumer never holds up the tick.
+// It can fall behind, though, so the queue holds at most max_batches;
+// a batch that finds it full is dropped and counted instead.
+
+
+struct ContactEvent {
+  uint32_t tick;
+  uint32_t boid;
+  uint32_t other; // always greater than boid, every pair is reported once
+  bool enter;
+};
+
+
+template <typename F>
+void diff_neighbours(const std::vector<uint32_t> &before, const std::vector<uint32_t> &after,
+                     uint32_t self, F &&emit) {
+  // both sorted, emit(other, enter) for every id in only one of them,
+  // skipping ourselves and the pairs the other boid reports
+  auto a = std::upper_bound(before.begin(), before.end(), self);
+  auto b = std::upper_bound(after.begin(), after.end(), self);
+  while (a != before.end() && b != after.end()) {
+    if (*a < *b) {
+      emit(*a++, false);
+    } else if (*b < *a) {
+      emit(*b++, true);
+    } else {
+      ++a;
+      ++b;
+    }
+  }
+  for (; a != before.end(); ++a)
+    emit(*a, false);
+  for (; b != after.end(); ++b)
+    emit(*b, true);
+}
+
+
+class ContactStream {
+public:
+  using Consumer = std::function<void(const std::vector<ContactEvent> &)>;
+
+  explicit ContactStream(Consumer consumer, size_t max_batches = 64)
+    : consumer(std::move(consumer))
+    , max_batches(max_batches)
+    , thread(&ContactStream::drain, this) {
+  }
+
+  ContactStream(const ContactStream &) = delete;
+
+  ~ContactStream() {
+    {
+      std::scoped_lock lock(queue_mutex);
+      stopping = true;
+    }
+    ready.notify_one();
+    thread.join();
+  }
+
+  std::vector<ContactEvent> &local() {
+    // each thread gets its own buffer
+    return buffers.local();
+  }
+
+  size_t flush() {
+    // call after ecs.wait(), when no worker is appending,
+    // returns the number of events handed on, not counting dropped ones
+    std::vector<ContactEvent> batch;
+    buffers.for_each([&](std::vector<ContactEvent> &b) {
+      batch.insert(batch.end(), b.begin(), b.end());
+      b.clear();
+    });
+    size_t n = batch.size();
+    if (n > 0) {
+      std::scoped_lock lock(queue_mutex);
+      if (queue.size() < max_batches) {
+        queue.push_back(std::move(batch));
+      } else {
+        dropped += n;
+        n = 0;
+      }
+    }
+    ready.notify_one();
+    return n;
+  }
+
+  void discard() {
+    // like flush, but the events are dropped instead
+    buffers.for_each([](std::vector<ContactEvent> &b) { b.clear(); });
+  }
+
+  uint64_t get_dropped() const {
+    // events dropped because the consumer was max_batches behind
+    return dropped;
+  }
+
+private:
+  void drain() {
+    std::unique_lock lock(queue_mutex);
+    while (true) {
+      ready.wait(lock, [&] { return stopping || !queue.empty(); });
+      if (queue.empty()) return; // only once stopping, nothing is dropped
+      auto batch = std::move(queue.front());
+      queue.pop_front();
+      lock.unlock();
+      consumer(batch);
+      lock.lock();
+    }
+  }
+
+  Consumer consumer;
+  size_t max_batches;
+  uint64_t dropped = 0; // only touched by flush()
+
+  PerThread<std::vector<ContactEvent>> buffers;
+
+  std::mutex queue_mutex;
+  std::condition_variable ready;
+  std::deque<std::vector<ContactEvent>> queue;
+  bool stopping = false;
+
+  std::thread thread; // last, so everything above exists when it starts
+};
+
+
+inline std::ostream &operator<<(std::ostream &out, const ContactEvent &e) {
+  return out << e.tick << '\t' << e.boid << '\t' << e.other << '\t'
+             << (e.enter ? "enter" : "leave") << '\n';
+}
+
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef __DEADLINE_H__
+#define __DEADLINE_H__
+
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <ostream>
+#include <span>
+#include <vector>
+
+
+// Keeps the logic tick inside its time budget by trading fidelity for
+// time, instead of letting the simulation fall behind the wall clock.
+// Every tick's duration is recorded; when the p99 over the last window
+// goes over budget the controller steps one level down FIDELITY_LADDER,
+// and once it has stayed under restore*budget for hold ticks it steps
+// back up one level. The window is cleared on every step so the next
+// decision is made on ticks run at the new level. (Over the default
+// window of 32 ticks the p99 is simply the slowest one.)
+//
+// The only knob is subsampling: it is the one that takes work out of the
+// neighbour pass. Capping the neighbours a boid steers by doesn't, every
+// candidate still has to be found and distance tested before it can be
+// left out.
+
+
+struct Fidelity {
+  uint32_t subsample; // a boid updates its velocity about once every this many ticks
+};
+
+
+constexpr std::array<Fidelity, 3> FIDELITY_LADDER {{
+  {1},
+  {2},
+  {4},
+}};
+
+
+inline std::ostream &operator<<(std::ostream &out, const Fidelity &f) {
+  return out << "subsample " << f.subsample;
+}
+
+
+class DeadlineController {
+public:
+  DeadlineController(double budget, std::span<const Fidelity> ladder = FIDELITY_LADDER,
+                     double restore = 0.6, size_t window = 32, size_t hold = 64)
+    : budget(budget)
+    , ladder(ladder)
+    , restore(restore)
+    , window(window)
+    , hold(hold) {
+  }
+
+  int record(double tick_time) {
+    // returns -1 after stepping down, 1 after stepping up, 0 otherwise
+    times.push_back(tick_time);
+    if (times.size() > window)
+      times.pop_front();
+    if (times.size() < window)
+      return 0;
+
+    double p = p99();
+    decided_p99 = p;
+    if (p > budget && level + 1 < ladder.size()) {
+      ++level;
+      reset();
+      return -1;
+    }
+    calm = p < restore*budget ? calm + 1 : 0;
+    if (calm >= hold && level > 0) {
+      --level;
+      reset();
+      return 1;
+    }
+    return 0;
+  }
+
+  double p99() const {
+    // of the current window, 0 while it is empty
+    if (times.empty()) return 0.0;
+    std::vector<double> sorted(times.begin(), times.end());
+    size_t k = std::min(sorted.size() - 1, (sorted.size()*99)/100);
+    std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+    return sorted[k];
+  }
+
+  const Fidelity &fidelity() const { return ladder[level]; }
+  size_t get_level() const { return level; }
+  double get_decided_p99() const { return decided_p99; } // p99 behind the last step
+  double get_budget() const { return budget; }
+
+private:
+  void reset() {
+    times.clear();
+    calm = 0;
+  }
+
+  const double budget;
+  const std::span<const Fidelity> ladder;
+  const double restore;
+  const size_t window;
+  const size_t hold;
+
+  std::deque<double> times;
+  size_t level = 0;
+  size_t calm = 0; // ticks in a row with the window under restore*budget
+  double decided_p99 = 0.0;
+};
+
+
+#endif
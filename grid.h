@@ -0,0 +1,237 @@
+#ifndef __GRID_H__
+#define __GRID_H__
+
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "perthread.h"
+
+
+// Uniform grid over a square [lo, hi] world, rebuilt with a counting sort.
+// Boid indices end up contiguous per cell, so a neighbour query is a walk
+// over the 3x3 block of cells around a point.
+//
+// Every cell is given some slack when built, so update() can move just
+// the boids that changed cell since the last call. When a cell runs out
+// of room, or every compact_every updates, it falls back to a full build.
+// update() either looks for those boids itself, or is handed a list of
+// them collected while they moved (Crossings below), which saves it
+// looking at every boid.
+//
+// build() and update() take a vector of anything with a position_of()
+// overload, so callers can index their own boid type directly.
+
+
+inline glm::vec2 position_of(glm::vec2 p) { return p; }
+inline glm::vec2 velocity_of(glm::vec2 v) { return v; } // for separate velocity vectors
+
+
+class Grid {
+public:
+  Grid(float lo, float hi, float cell_size, int compact_every = 32)
+    : lo(lo)
+    , cell_size(cell_size)
+    , dim(std::max(static_cast<int>((hi - lo)/cell_size), 1))
+    , compact_every(compact_every)
+    , cell_start(dim*dim + 1)
+    , cell_count(dim*dim) {
+  }
+
+  int cell_of(glm::vec2 p) const {
+    int x = std::clamp(static_cast<int>((p.x - lo)/cell_size), 0, dim - 1);
+    int y = std::clamp(static_cast<int>((p.y - lo)/cell_size), 0, dim - 1);
+    return y*dim + x;
+  }
+
+  template <typename T>
+  void build(const std::vector<T> &pos) {
+    uint32_t n = pos.size();
+    cell.resize(n);
+    slot.resize(n);
+    std::fill(cell_count.begin(), cell_count.end(), 0);
+    for (uint32_t i = 0; i < n; ++i) {
+      cell[i] = cell_of(position_of(pos[i]));
+      ++cell_count[cell[i]];
+    }
+
+    // a quarter extra room per cell, plus a little for empty ones
+    cell_start[0] = 0;
+    for (int c = 0; c < dim*dim; ++c)
+      cell_start[c + 1] = cell_start[c] + cell_count[c] + cell_count[c]/4 + 2;
+    sorted.resize(cell_start[dim*dim]);
+
+    std::fill(cell_count.begin(), cell_count.end(), 0);
+    for (uint32_t i = 0; i < n; ++i)
+      insert(i, cell[i]);
+    updates = 0;
+  }
+
+  template <typename T>
+  uint32_t update(const std::vector<T> &pos) {
+    // relocate boids that crossed a cell boundary, returns how many did
+    if (pos.size() != cell.size() || ++updates >= compact_every) {
+      build(pos);
+      return pos.size();
+    }
+
+    uint32_t moved = 0;
+    for (uint32_t i = 0; i < pos.size(); ++i) {
+      uint32_t c = cell_of(position_of(pos[i]));
+      if (c == cell[i]) continue;
+      if (!relocate(i, c)) {
+        build(pos);
+        return pos.size();
+      }
+      ++moved;
+    }
+    return moved;
+  }
+
+  template <typename T>
+  uint32_t update(const std::vector<T> &pos, const std::vector<uint32_t> &crossed) {
+    // same, but only looks at the boids in crossed, which whoever moved
+    // them found to be out of their cell (see moved_out), so it costs
+    // the number of crossings rather than the number of boids
+    if (pos.size() != cell.size() || ++updates >= compact_every) {
+      build(pos);
+      return pos.size();
+    }
+
+    for (uint32_t i: crossed) {
+      if (!relocate(i, cell_of(position_of(pos[i])))) {
+        build(pos);
+        return pos.size();
+      }
+    }
+    return crossed.size();
+  }
+
+  bool moved_out(uint32_t i, glm::vec2 p) const {
+    // whether boid i, now at p, is no longer in the cell it was put in;
+    // read only, so it can be called from parallel passes
+    return i < cell.size() && cell_of(p) != static_cast<int>(cell[i]);
+  }
+
+  int get_dim() const { return dim; }
+  float get_lo() const { return lo; }
+  float get_cell_size() const { return cell_size; }
+  uint32_t num_cells() const { return dim*dim; }
+
+  uint32_t count_in(uint32_t c) const { return cell_count[c]; }
+
+  template <typename F>
+  void for_each_in(uint32_t c, F &&fn) const {
+    // calls fn(index) for every boid in cell c
+    for (uint32_t k = cell_start[c]; k < cell_start[c] + cell_count[c]; ++k)
+      fn(sorted[k]);
+  }
+
+  template <typename F>
+  void for_each_cell_near(uint32_t c, F &&fn) const {
+    // calls fn(cell) for c and the cells around it
+    int cx = c % dim, cy = c / dim;
+    for (int y = std::max(cy - 1, 0); y <= std::min(cy + 1, dim - 1); ++y)
+      for (int x = std::max(cx - 1, 0); x <= std::min(cx + 1, dim - 1); ++x)
+        fn(static_cast<uint32_t>(y*dim + x));
+  }
+
+  template <typename F>
+  void for_each_near(glm::vec2 p, F &&fn) const {
+    // calls fn(index) for every boid in the 3x3 cells around p,
+    // the caller does the actual distance check
+    int c = cell_of(p);
+    int cx = c % dim, cy = c / dim;
+    for (int y = std::max(cy - 1, 0); y <= std::min(cy + 1, dim - 1); ++y) {
+      for (int x = std::max(cx - 1, 0); x <= std::min(cx + 1, dim - 1); ++x) {
+        int nc = y*dim + x;
+        for (uint32_t k = cell_start[nc]; k < cell_start[nc] + cell_count[nc]; ++k)
+          fn(sorted[k]);
+      }
+    }
+  }
+
+  template <typename F>
+  void for_each_within(glm::vec2 p, float radius, F &&fn) const {
+    // like for_each_near, but for every cell the square around p touches,
+    // for radii that don't match the cell size
+    int x0 = cell_of(p - glm::vec2(radius)) % dim;
+    int y0 = cell_of(p - glm::vec2(radius)) / dim;
+    int x1 = cell_of(p + glm::vec2(radius)) % dim;
+    int y1 = cell_of(p + glm::vec2(radius)) / dim;
+    for (int y = y0; y <= y1; ++y) {
+      for (int x = x0; x <= x1; ++x) {
+        int nc = y*dim + x;
+        for (uint32_t k = cell_start[nc]; k < cell_start[nc] + cell_count[nc]; ++k)
+          fn(sorted[k]);
+      }
+    }
+  }
+
+private:
+  bool relocate(uint32_t i, uint32_t c) {
+    // false when c is out of slack, the caller starts over then
+    if (c == cell[i]) return true;
+    if (cell_count[c] == cell_start[c + 1] - cell_start[c])
+      return false;
+    remove(i);
+    insert(i, c);
+    return true;
+  }
+
+  void insert(uint32_t i, uint32_t c) {
+    cell[i] = c;
+    slot[i] = cell_start[c] + cell_count[c]++;
+    sorted[slot[i]] = i;
+  }
+
+  void remove(uint32_t i) {
+    // swap the last boid of the cell into the hole
+    uint32_t c = cell[i];
+    uint32_t last = sorted[cell_start[c] + --cell_count[c]];
+    sorted[slot[i]] = last;
+    slot[last] = slot[i];
+  }
+
+  const float lo;
+  const float cell_size;
+  const int dim;
+  const int compact_every;
+  int updates = 0;
+
+  std::vector<uint32_t> cell_start; // cell_start[c + 1] - cell_start[c] is the room in c
+  std::vector<uint32_t> cell_count;
+  std::vector<uint32_t> cell; // cell of every boid
+  std::vector<uint32_t> slot; // index of every boid in sorted
+  std::vector<uint32_t> sorted;
+};
+
+
+class Crossings {
+  // boids that left their cell, collected by a parallel pass for
+  // Grid::update; each thread appends to its own list, like FlockStats
+public:
+  std::vector<uint32_t> &local() {
+    return lists.local();
+  }
+
+  const std::vector<uint32_t> &collect() {
+    // call when no pass is appending, the result lives until the next call
+    all.clear();
+    lists.for_each([&](std::vector<uint32_t> &l) {
+      all.insert(all.end(), l.begin(), l.end());
+      l.clear();
+    });
+    return all;
+  }
+
+private:
+  PerThread<std::vector<uint32_t>> lists;
+  std::vector<uint32_t> all;
+};
+
+
+#endif
@@ -0,0 +1,109 @@
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "pool.h"
+#include "raster.h"
+#include "world.h"
+
+
+// Headless run of one big flock, rasterized on the cpu every tick and
+// written out as y4m video, for render nodes without a gpu.
+// e.g. ./boids_headless | ffmpeg -i - boids.mp4  with VIDEO_OUT = "-"
+
+
+constexpr int HEADLESS_BOIDS = 1 << 20;
+constexpr int HEADLESS_TICKS = 300;
+constexpr float HEADLESS_SENSE_RAD = 0.01;
+
+constexpr int VIDEO_WIDTH = 1024;
+constexpr int VIDEO_HEIGHT = 1024;
+constexpr int VIDEO_FPS = 10; // one frame per logic tick
+constexpr bool VIDEO_GLYPHS = true;
+constexpr const char *VIDEO_OUT = "boids.y4m";
+
+// full rules only inside a region circling the middle, see world.h
+constexpr bool HEADLESS_LOD = true;
+constexpr float ROI_RADIUS = 0.3;
+constexpr float ROI_MARGIN = 0.05;
+constexpr float ROI_ORBIT = 0.4; // distance of the region from the origin
+constexpr float ROI_SPEED = 0.01; // radians per tick
+
+
+int main() {
+  Pool pool; // shared by the world and the rasterizer, they take turns
+
+  World world(Params{HEADLESS_SENSE_RAD, 0.002, 0.02, 0.03, 2701}, HEADLESS_BOIDS);
+  Rasterizer raster(VIDEO_WIDTH, VIDEO_HEIGHT, -1.0f, 1.0f, pool);
+  Y4MWriter video(VIDEO_OUT, VIDEO_WIDTH, VIDEO_HEIGHT, VIDEO_FPS);
+  if (!video.good()) {
+    std::cerr << "Failed to open " << VIDEO_OUT << std::endl;
+    return -1;
+  }
+
+  // timing goes to stderr, stdout may be the video
+  auto timer = [] {
+    return std::chrono::duration<double>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  };
+  double logic_time = 0.0;
+  double raster_time = 0.0;
+  double write_time = 0.0;
+  double full_time = 0.0;
+  double reduced_time = 0.0;
+  uint64_t full_boids = 0;
+  uint64_t swaps = 0;
+
+  for (int tick = 1; tick <= HEADLESS_TICKS; ++tick) {
+    if (HEADLESS_LOD) {
+      float a = ROI_SPEED*tick;
+      glm::vec2 center = ROI_ORBIT*glm::vec2(std::cos(a), std::sin(a));
+      world.set_roi(Roi{center, ROI_RADIUS, ROI_MARGIN});
+    }
+
+    double t0 = timer();
+    world.tick(nullptr, &pool);
+    double t1 = timer();
+    raster.render(world.pos, VIDEO_GLYPHS ? &world.vel : nullptr);
+    double t2 = timer();
+    if (!video.write(raster.get_luma())) {
+      std::cerr << "Failed to write " << VIDEO_OUT << " at tick " << tick << std::endl;
+      return -1;
+    }
+    double t3 = timer();
+
+    logic_time += t1 - t0;
+    raster_time += t2 - t1;
+    write_time += t3 - t2;
+
+    auto &lod = world.get_lod_report();
+    full_time += lod.full_time;
+    reduced_time += lod.reduced_time;
+    full_boids += lod.full;
+    swaps += lod.promoted + lod.demoted;
+
+    if (tick % 10 == 0) {
+      std::cerr << "Average logic step: " << logic_time/10.0;
+      std::cerr << "\tRaster: " << raster_time/10.0;
+      std::cerr << "\tWrite: " << write_time/10.0 << std::endl;
+      if (HEADLESS_LOD) {
+        uint64_t reduced_boids = 10ull*HEADLESS_BOIDS - full_boids;
+        std::cerr << "LOD full: " << full_boids/10 << " boids " << full_time/10.0;
+        std::cerr << "\treduced: " << reduced_boids/10 << " boids " << reduced_time/10.0;
+        if (full_boids > 0 && reduced_boids > 0) {
+          std::cerr << "\tper boid full/reduced: "
+                    << (full_time/full_boids)/(reduced_time/reduced_boids);
+        }
+        std::cerr << "\tswaps: " << swaps/10 << std::endl;
+      }
+      logic_time = raster_time = write_time = 0.0;
+      full_time = reduced_time = 0.0;
+      full_boids = swaps = 0;
+    }
+  }
+
+  return 0;
+}
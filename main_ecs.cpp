@@ -1,7 +1,8 @@
+#include <algorithm>
 #include <atomic>
+#include <fstream>
 #include <iostream>
 #include <mutex>
-#include <random>
 #include <thread>
 #include <unordered_map>
 
@@ -15,10 +16,16 @@
 #include "ecsoplatm.h"
 
 
+#include "pacing.h"
+#include "perfcount.h"
+#include "sdf.h"
+#include "spawn.h"
+#include "stats.h"
 #include "shader.cpp"
 
 
 constexpr double LOGIC_DT = 0.1;
+constexpr double RENDER_FPS = 60.0; // 0 to follow vsync instead
 constexpr int NUM_BOIDS = 4096;
 
 constexpr float BOID_VEL = 0.05;
@@ -26,6 +33,18 @@ constexpr float SENSE_RAD = 0.1;
 constexpr float BOID_CENTER = 0.002;
 constexpr float BOID_NEAR = 0.02;
 constexpr float BOID_STEER = 0.03;
+constexpr float BOID_AVOID = 0.05;
+
+constexpr float AVOID_RAD = 0.1; // start steering this far from an obstacle
+constexpr int SDF_RES = 256;
+
+constexpr uint64_t SPAWN_SEED = 2701;
+constexpr SpawnConfig SPAWN {SpawnConfig::UNIFORM};
+
+constexpr bool PERF_COUNTERS = false; // hardware counters per tick phase
+
+constexpr bool FLOCK_STATS = false; // per tick metrics, see stats.h
+constexpr const char *STATS_FILE = "flock_stats.tsv";
 
 
 std::mutex triple_buffer_mutex;
@@ -70,6 +89,11 @@ std::vector<uint32_t> neighbours(glm::vec2 v,
   hashes.push_back(hashable(v - dx + dy));
   hashes.push_back(hashable(v - dx - dy));
 
+  // x ^ y sends several of the 9 cells to the same key, and a bucket
+  // visited twice would list its boids twice
+  std::sort(hashes.begin(), hashes.end());
+  hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+
   for (auto hash: hashes) {
     auto range = spatial_hash->equal_range(hash);
     for (auto it = range.first; it != range.second; ++it) {
@@ -95,6 +119,8 @@ struct update_vel_payload {
   ecs::Component<glm::vec2> *c_pos;
   ecs::Component<glm::vec2> *c_vel;
   std::unordered_multimap<int, uint32_t> *spatial_hash;
+  const SDF *sdf;
+  FlockStats *stats;
 };
 
 void update_vel(glm::vec2 &pos, glm::vec2 &vel, void *payload) {
@@ -126,14 +152,33 @@ void update_vel(glm::vec2 &pos, glm::vec2 &vel, void *payload) {
   if (glm::length(steer) > 0.0f)
     steer = glm::normalize(steer);
 
+  // obstacles, stronger the closer we are
+  glm::vec2 avoid(0.0f);
+  auto obstacle = pl->sdf->sample(pos);
+  if (obstacle.dist < AVOID_RAD)
+    avoid = (1.0f - obstacle.dist/AVOID_RAD)*obstacle.grad;
+
   vel = BOID_VEL*glm::normalize(vel +
                                 BOID_CENTER*center +
                                 BOID_NEAR*near +
-                                BOID_STEER*steer);
+                                BOID_STEER*steer +
+                                BOID_AVOID*avoid);
+
+  if constexpr (FLOCK_STATS)
+    pl->stats->local().add(vel, nbs.size() - 1); // nbs includes this boid
 }
 
-void move(glm::vec2 &pos, glm::vec2 &vel) {
+void move(glm::vec2 &pos, glm::vec2 &vel, void *payload) {
+  auto sdf = static_cast<SDF *>(payload);
   pos += vel;
+
+  // if we still ended up inside an obstacle, push out and bounce
+  auto obstacle = sdf->sample(pos);
+  if (obstacle.dist < 0.0f) {
+    pos -= obstacle.dist*obstacle.grad;
+    vel -= 2.0f*glm::dot(vel, obstacle.grad)*obstacle.grad;
+  }
+
   if (pos.x < -1.0f) {
     pos.x = -2.0f - pos.x;
     vel.x = -vel.x;
@@ -184,6 +229,11 @@ void draw(GLFWwindow *window, ecs::Component<Posbuf> &c_posbuf) {
 
   glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 
+  // pace ourselves instead of rendering as fast as we can
+  glfwSwapInterval(RENDER_FPS > 0.0 ? 0 : 1);
+  FramePacer pacer(RENDER_FPS > 0.0 ? RENDER_FPS : 1.0);
+  CpuMeter cpu;
+
   // for tracking graphics fps
   int frames = 0;
   double frame_start = glfwGetTime();
@@ -216,6 +266,8 @@ void draw(GLFWwindow *window, ecs::Component<Posbuf> &c_posbuf) {
     glDrawArrays(GL_POINTS, 0, NUM_BOIDS);
 
     glfwSwapBuffers(window);
+    if (RENDER_FPS > 0.0)
+      pacer.wait();
 
     frame_time = glfwGetTime();
     if (frame_time - frame_start > 1.0 || frames == 0) {
@@ -224,7 +276,8 @@ void draw(GLFWwindow *window, ecs::Component<Posbuf> &c_posbuf) {
           (frame_time - frame_start) / static_cast<double>(frames);
       frame_start = frame_time;
       frames = 0;
-      std::cout << "fps\t" << fps << "\tframe_time\t" << frm_time << std::endl;
+      std::cout << "fps\t" << fps << "\tframe_time\t" << frm_time;
+      std::cout << "\tcpu\t" << cpu.usage() << std::endl;
     }
     ++frames;
   }
@@ -274,21 +327,25 @@ int main() {
   last_tick_time = glfwGetTime();
   next_tick_time = glfwGetTime();
 
-  std::mt19937 rng;
-  rng.seed(2701);
-  std::uniform_real_distribution<float> dist(-1.0, 1.0);
+  // random numbers are drawn in parallel, the same seed gives
+  // the same boids regardless of thread count
+  auto population = spawn_population(SPAWN_SEED, NUM_BOIDS, SPAWN);
 
   for (int i = 0; i < NUM_BOIDS; ++i) {
     auto id = ecs.get_id();
-    glm::vec2 pos(dist(rng), dist(rng));
-    glm::vec2 vel(dist(rng), dist(rng));
-    vel = glm::normalize(vel)*BOID_VEL;
+    glm::vec2 pos = population.pos[i];
+    glm::vec2 vel = population.vel[i]*BOID_VEL;
     c_pos.create(id, pos);
     c_posbuf.create(id, Posbuf{pos - vel, pos});
     c_vel.create(id, vel);
   }
   ecs.update();
 
+  // before the draw thread exists, so only logic threads are counted
+  PerfCounters perf;
+  if (PERF_COUNTERS)
+    perf.attach();
+
   // transfer graphics to separate thread
   glfwMakeContextCurrent(nullptr);
   std::thread draw_thread(&draw, window, std::ref(c_posbuf));
@@ -305,9 +362,27 @@ int main() {
   double logic_time = 0.0;
   double worst_logic_time = 0.0;
   int logic_ticks = 0;
+  CpuMeter main_cpu;
+  int total_ticks = 0;
 
   std::unordered_multimap<int, uint32_t> spatial_hash;
 
+  // static obstacles, only rasterized once
+  std::vector<Obstacle> obstacles {
+    {Obstacle::CIRCLE, glm::vec2(-0.4f, 0.3f), glm::vec2(0.15f, 0.0f)},
+    {Obstacle::CIRCLE, glm::vec2(0.5f, -0.5f), glm::vec2(0.1f, 0.0f)},
+    {Obstacle::BOX, glm::vec2(0.3f, 0.4f), glm::vec2(0.05f, 0.25f)},
+  };
+  SDF sdf(-1.0f, 1.0f, SDF_RES);
+  sdf.rasterize(obstacles);
+
+  FlockStats stats;
+  std::ofstream stats_out;
+  if (FLOCK_STATS) {
+    stats_out.open(STATS_FILE);
+    write_header(stats_out);
+  }
+
   while (!glfwWindowShouldClose(window)) {
 
     current_time = glfwGetTime();
@@ -325,18 +400,30 @@ int main() {
 
       auto logic_timer = [start = glfwGetTime()]{ return glfwGetTime() - start; };
 
+      perf.begin();
+
       // logic here
       // first build our spatial hash
       spatial_hash.clear();
       for (auto [id, pos]: c_pos.data) {
         spatial_hash.insert(std::make_pair(hashable(pos), id));
       }
+      perf.mark("hash");
 
       // then update all the boids
-      update_vel_payload uv_payload(&c_pos, &c_vel, &spatial_hash);
+      update_vel_payload uv_payload(&c_pos, &c_vel, &spatial_hash, &sdf, &stats);
       ecs.apply(&update_vel, c_pos, c_vel, static_cast<void *>(&uv_payload));
-      ecs.apply(&move, c_pos, c_vel);
+      if constexpr (PERF_COUNTERS) {
+        // only split the phases when someone is looking
+        ecs.wait();
+        perf.mark("update_vel");
+      }
+      ecs.apply(&move, c_pos, c_vel, static_cast<void *>(&sdf));
       ecs.wait();
+      perf.mark("move");
+
+      if constexpr (FLOCK_STATS)
+        stats_out << stats.reduce();
 
       {
         std::scoped_lock lock(triple_buffer_mutex);
@@ -345,6 +432,7 @@ int main() {
 
         ecs.apply(&update_posbuf, c_pos, c_posbuf);
         ecs.wait();
+        perf.mark("posbuf");
       }
 
       accumulator -= LOGIC_DT;
@@ -352,10 +440,12 @@ int main() {
       logic_time += logic_timer();
       worst_logic_time = std::max(logic_timer(), worst_logic_time);
       ++logic_ticks;
+      ++total_ticks;
 
       if (logic_ticks == 9) {
         std::cout << "Averageg logic step: " << logic_time/10.0;
-        std::cout << "\tWorst: " << worst_logic_time << std::endl;
+        std::cout << "\tWorst: " << worst_logic_time;
+        std::cout << "\tMain cpu: " << main_cpu.usage() << std::endl;
         logic_ticks = 0;
         logic_time = 0.0;
         worst_logic_time = 0.0;
@@ -367,11 +457,16 @@ int main() {
 
     // what goes here? input?
 
+    // sleep (still handling events) until the next tick is due
+    wait_events_until(start_time + LOGIC_DT - accumulator);
+
   }
 
   running.store(false);
   draw_thread.join();
 
+  perf.report(static_cast<uint64_t>(total_ticks)*NUM_BOIDS);
+
   // end program section
 
   glfwTerminate();
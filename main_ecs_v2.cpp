@@ -1,7 +1,13 @@
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <csignal>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <memory>
 #include <mutex>
-#include <random>
+#include <sstream>
 #include <thread>
 #include <unordered_map>
 
@@ -15,10 +21,31 @@
 #include "ecsoplatm.h"
 
 
+#include "autotune.h"
+#include "clusters.h"
+#include "contacts.h"
+#include "deadline.h"
+#include "grid.h"
+#include "multigrid.h"
+#include "multirate.h"
+#include "pacing.h"
+#include "perfcount.h"
+#include "pool.h"
+#include "pyramid.h"
+#include "renderring.h"
+#include "sdf.h"
+#include "shmstate.h"
+#include "sparsegrid.h"
+#include "spawn.h"
+#include "stats.h"
 #include "shader.cpp"
 
 
 constexpr double LOGIC_DT = 0.1;
+constexpr double TICK_BUDGET = 0.8*LOGIC_DT; // p99 tick time to hold, see deadline.h
+constexpr double MAX_BACKLOG = 0.5; // seconds behind before we give up on catching up
+constexpr double RENDER_FPS = 60.0; // 0 to follow vsync instead
+constexpr bool PERSISTENT_RING = true; // simulation writes into mapped gl memory, see renderring.h
 constexpr int NUM_BOIDS = 8192;
 
 constexpr float BOID_VEL = 0.05;
@@ -26,6 +53,75 @@ constexpr float SENSE_RAD = 0.1;
 constexpr float BOID_CENTER = 0.002;
 constexpr float BOID_NEAR = 0.02;
 constexpr float BOID_STEER = 0.03;
+constexpr float BOID_AVOID = 0.05;
+
+constexpr float AVOID_RAD = 0.1; // start steering this far from an obstacle
+constexpr int SDF_RES = 256;
+
+enum class IndexBackend { HASH, GRID, GRID_INCREMENTAL, MULTI_GRID, SPARSE_GRID };
+constexpr IndexBackend INDEX_BACKEND = IndexBackend::GRID_INCREMENTAL;
+
+// no walls, flocks drift as far as they like (needs the SPARSE_GRID backend,
+// the others only cover [-1, 1])
+constexpr bool UNBOUNDED = false;
+static_assert(!UNBOUNDED || INDEX_BACKEND == IndexBackend::SPARSE_GRID,
+              "an unbounded world needs the sparse grid");
+
+// perception radius of each species, boids are spread evenly over them,
+// more than one species needs the MULTI_GRID backend
+constexpr std::array<float, 1> SPECIES_SENSE_RAD {SENSE_RAD};
+static_assert(SPECIES_SENSE_RAD.size() == 1 || INDEX_BACKEND == IndexBackend::MULTI_GRID,
+              "mixed perception radii need the multi level grid");
+
+// cohesion and alignment over a larger radius from per cell sums,
+// separation stays exact within SENSE_RAD (needs a grid backend)
+constexpr bool FAR_FIELD = false;
+constexpr float FAR_SENSE_RAD = 0.4;
+static_assert(!FAR_FIELD || INDEX_BACKEND == IndexBackend::GRID
+              || INDEX_BACKEND == IndexBackend::GRID_INCREMENTAL,
+              "the far field is built on the single level grid");
+
+// cohesion and alignment are refreshed every SLOW_EVERY ticks, each tick
+// for a different 1/SLOW_EVERY of the boids, and cached in between;
+// separation runs every tick, but within NEAR_SENSE_RAD only (multirate.h)
+// (needs a grid backend, with cells of NEAR_SENSE_RAD unless tuned)
+constexpr bool MULTI_RATE = false;
+constexpr uint32_t SLOW_EVERY = 4;
+constexpr float NEAR_SENSE_RAD = 0.05;
+static_assert(!MULTI_RATE || (!FAR_FIELD && (INDEX_BACKEND == IndexBackend::GRID
+                                             || INDEX_BACKEND == IndexBackend::GRID_INCREMENTAL)),
+              "multi rate steering is built on the single level grid");
+static_assert(NEAR_SENSE_RAD <= SENSE_RAD);
+
+constexpr uint64_t SPAWN_SEED = 2701;
+constexpr SpawnConfig SPAWN {SpawnConfig::UNIFORM};
+
+// time a few index configurations at startup, and cache the winner
+// (under ~/.cache); picks the backend in place of INDEX_BACKEND, from
+// the ones the options above allow
+constexpr bool AUTO_TUNE = false;
+constexpr int TUNE_TICKS = 5;
+constexpr const char *TUNE_CACHE = "boids/autotune.cache";
+
+constexpr bool PERF_COUNTERS = false; // hardware counters per tick phase
+
+constexpr bool FLOCK_STATS = false; // per tick metrics, see stats.h
+constexpr const char *STATS_FILE = "flock_stats.tsv";
+
+constexpr int CLUSTER_EVERY = 0; // ticks between flock identification, 0 is off
+
+// pairs coming within SENSE_RAD and separating again, see contacts.h
+// (needs a grid backend, and the plain update_vel rules)
+constexpr bool CONTACT_EVENTS = false;
+constexpr const char *CONTACTS_FILE = "contacts.tsv";
+static_assert(!CONTACT_EVENTS || (!FAR_FIELD && !MULTI_RATE
+                                  && (INDEX_BACKEND == IndexBackend::GRID
+                                      || INDEX_BACKEND == IndexBackend::GRID_INCREMENTAL
+                                      || INDEX_BACKEND == IndexBackend::SPARSE_GRID)),
+              "contact events come from the plain grid neighbour pass");
+
+constexpr bool SHM_PUBLISH = false; // latest tick for other processes, see shmstate.h
+constexpr const char *SHM_NAME = "/boids3";
 
 
 std::mutex triple_buffer_mutex;
@@ -44,8 +140,18 @@ struct Posbuf {
 struct Boid {
   glm::vec2 pos;
   glm::vec2 vel;
+  uint32_t species = 0;
+  uint32_t self = 0; // our index in the snapshot
 };
 
+struct Contacts {
+  uint32_t self; // our index in the snapshot
+  std::vector<uint32_t> ids; // last tick's neighbours, sorted
+};
+
+glm::vec2 position_of(const Boid &boid) { return boid.pos; }
+glm::vec2 velocity_of(const Boid &boid) { return boid.vel; }
+
 
 int hashable(glm::vec2 v) {
   // convert for use in spatial hash
@@ -56,7 +162,7 @@ int hashable(glm::vec2 v) {
 
 
 std::vector<Boid> neighbours(glm::vec2 v,
-                                 std::unordered_multimap<int, Boid> *spatial_hash) {
+                                 const std::unordered_multimap<int, Boid> *spatial_hash) {
   // returns the neighbours of a point
   std::vector<Boid> result;
   glm::vec2 dx(SENSE_RAD, 0.0);
@@ -74,6 +180,11 @@ std::vector<Boid> neighbours(glm::vec2 v,
   hashes.push_back(hashable(v - dx + dy));
   hashes.push_back(hashable(v - dx - dy));
 
+  // x ^ y sends several of the 9 cells to the same key, and a bucket
+  // visited twice would list its boids twice
+  std::sort(hashes.begin(), hashes.end());
+  hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+
   for (auto hash: hashes) {
     auto range = spatial_hash->equal_range(hash);
     for (auto it = range.first; it != range.second; ++it) {
@@ -88,6 +199,146 @@ std::vector<Boid> neighbours(glm::vec2 v,
 }
 
 
+template <typename G>
+std::vector<Boid> neighbours(glm::vec2 v, const G *grid,
+                             const std::vector<Boid> *snapshot) {
+  // same as above, but from a grid (dense or sparse) over last tick's snapshot
+  std::vector<Boid> result;
+  grid->for_each_near(v, [&](uint32_t i) {
+    glm::vec2 other = (*snapshot)[i].pos;
+    if (glm::dot(other - v, other - v) < SENSE_RAD*SENSE_RAD) {
+      result.push_back((*snapshot)[i]);
+    }
+  });
+  return result;
+}
+
+
+std::vector<Boid> neighbours(glm::vec2 v, float radius, const MultiGrid *multi_grid,
+                             const std::vector<Boid> *snapshot) {
+  // everyone within our own radius, from the level sized for it
+  std::vector<Boid> result;
+  multi_grid->for_each_within(v, radius, [&](uint32_t i) {
+    glm::vec2 other = (*snapshot)[i].pos;
+    if (glm::dot(other - v, other - v) < radius*radius) {
+      result.push_back((*snapshot)[i]);
+    }
+  });
+  return result;
+}
+
+
+struct SpatialIndex {
+  // everything update_vel can look neighbours up in,
+  // the backend decides which of them are kept up to date
+  SpatialIndex(IndexBackend backend, float cell_size)
+    : backend(backend)
+    , grid(-1.0f, 1.0f, cell_size)
+    , pyramid(grid)
+    , multi_grid(-1.0f, 1.0f, {SPECIES_SENSE_RAD.begin(), SPECIES_SENSE_RAD.end()})
+    , sparse_grid(cell_size) {
+  }
+
+  void rebuild(ecs::Component<Boid> &c_boids) {
+    // does nothing if no boid has moved since the last call
+    if (!stale) return;
+    stale = false;
+
+    if (backend == IndexBackend::HASH) {
+      spatial_hash.clear();
+      for (auto [id, boid]: c_boids.data) {
+        spatial_hash.insert(std::make_pair(hashable(boid.pos), boid));
+      }
+      return;
+    }
+
+    // the grids only hold indices, so they need a copy that update_vel
+    // won't be writing to; move() keeps it current (see moved), so it's
+    // only copied whole the first time, into the same slots moved() and
+    // the grids use, whatever order the component keeps its data in
+    if (snapshot.size() != c_boids.data.size()) {
+      snapshot.resize(c_boids.data.size());
+      for (auto [id, boid]: c_boids.data) {
+        snapshot[boid.self] = boid;
+      }
+    }
+    if (backend == IndexBackend::GRID_INCREMENTAL)
+      grid.update(snapshot, crossings.collect());
+    else if (backend == IndexBackend::MULTI_GRID)
+      multi_grid.build(snapshot);
+    else if (backend == IndexBackend::SPARSE_GRID)
+      sparse_grid.build(snapshot);
+    else
+      grid.build(snapshot);
+    if constexpr (FAR_FIELD)
+      pyramid.build(snapshot);
+  }
+
+  void moved(const Boid &boid) {
+    // from move(), for every boid in parallel once update_vel is done
+    // reading the snapshot: writes the boid's new state into it, and
+    // notes it for grid.update if it left its cell
+    if (boid.self >= snapshot.size()) return; // no snapshot (yet)
+    snapshot[boid.self] = boid;
+    if (backend == IndexBackend::GRID_INCREMENTAL && grid.moved_out(boid.self, boid.pos))
+      crossings.local().push_back(boid.self);
+  }
+
+  void mark_moved() {
+    // after every boid has moved
+    stale = true;
+  }
+
+  const IndexBackend backend;
+  bool stale = true;
+  std::unordered_multimap<int, Boid> spatial_hash;
+  std::vector<Boid> snapshot;
+  Crossings crossings;
+  Grid grid;
+  Pyramid pyramid;
+  MultiGrid multi_grid;
+  SparseGrid sparse_grid;
+};
+
+
+Clusters find_flocks(SpatialIndex &index, ecs::Component<Boid> &c_boids, Pool &pool) {
+  // on the index's own grid when it has one with cells wide enough,
+  // brought up to where the boids are now (which leaves nothing for
+  // the next tick's rebuild to do)
+  index.rebuild(c_boids);
+  switch (index.backend) {
+  case IndexBackend::GRID:
+  case IndexBackend::GRID_INCREMENTAL:
+    if (index.grid.get_cell_size() >= SENSE_RAD)
+      return find_clusters(index.snapshot, index.snapshot, SENSE_RAD, index.grid, pool);
+    return find_clusters(index.snapshot, index.snapshot, SENSE_RAD, pool);
+  case IndexBackend::SPARSE_GRID:
+    if (index.sparse_grid.get_cell_size() >= SENSE_RAD)
+      return find_clusters(index.snapshot, index.snapshot, SENSE_RAD, index.sparse_grid, pool);
+    return find_clusters(index.snapshot, index.snapshot, SENSE_RAD, pool);
+  case IndexBackend::MULTI_GRID:
+    return find_clusters(index.snapshot, index.snapshot, SENSE_RAD, pool);
+  default:
+    break;
+  }
+  std::vector<Boid> boids;
+  boids.reserve(c_boids.data.size());
+  for (auto &[id, boid]: c_boids.data)
+    boids.push_back(boid);
+  return find_clusters(boids, boids, SENSE_RAD, pool);
+}
+
+
+volatile std::sig_atomic_t interrupted = 0;
+
+void on_interrupt(int signal) {
+  // ctrl-c and kill leave through the end of main, so destructors get to
+  // clean up (the shared memory segment, mostly); a second one doesn't wait
+  interrupted = 1;
+  std::signal(signal, SIG_DFL);
+}
+
+
 void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
   glfwMakeContextCurrent(window); // unsure about this...
   glViewport(0, 0, width, height);
@@ -96,24 +347,33 @@ void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
 }
 
 
-void update_vel(Boid &boid, void *payload) {
-  // NOTE having a boid struct with pos and vel would be more elegant
-  auto spatial_hash = static_cast<std::unordered_multimap<int, Boid> *>(payload);
-  auto nbs = neighbours(boid.pos, spatial_hash);
+struct update_vel_payload {
+  const SpatialIndex *index;
+  const SDF *sdf;
+  FlockStats *stats;
+  uint32_t tick;
+  ContactStream *contacts;
+  Fidelity fidelity;
+};
 
-  glm::vec2 center(0.0f);
-  glm::vec2 near(0.0f);
-  for (auto nb: nbs) {
-    center += nb.pos;
-    near -= nb.pos - boid.pos;
-  }
-  center = center - static_cast<float>(nbs.size())*boid.pos;
 
-  glm::vec2 steer(0.0f);
-  for (auto nb: nbs) {
-    steer += nb.vel;
-  }
+bool skip_this_tick(const Boid &boid, const update_vel_payload *pl) {
+  // when subsampling, keep last tick's velocity for all but about
+  // 1/subsample of the boids; we have no index here, but positions
+  // change every tick, so hashing them picks a fresh subset each time
+  if (pl->fidelity.subsample <= 1) return false;
+  uint32_t h;
+  std::memcpy(&h, &boid.pos.x, sizeof(h));
+  h ^= h >> 16;
+  h *= 0x7feb352d;
+  h ^= h >> 15;
+  return h % pl->fidelity.subsample != 0;
+}
+
 
+void apply_steering(Boid &boid, glm::vec2 center, glm::vec2 near, glm::vec2 steer,
+                    size_t num_nbs, const update_vel_payload *pl) {
+  // the rule vectors are summed, the rest is shared by all the modes
   if (glm::length(center) > 0.0f)
     center = glm::normalize(center);
   if (glm::length(near) > 0.0f)
@@ -121,31 +381,179 @@ void update_vel(Boid &boid, void *payload) {
   if (glm::length(steer) > 0.0f)
     steer = glm::normalize(steer);
 
+  // obstacles, stronger the closer we are
+  glm::vec2 avoid(0.0f);
+  auto obstacle = pl->sdf->sample(boid.pos);
+  if (obstacle.dist < AVOID_RAD)
+    avoid = (1.0f - obstacle.dist/AVOID_RAD)*obstacle.grad;
+
   boid.vel = BOID_VEL*glm::normalize(boid.vel +
                                 BOID_CENTER*center +
                                 BOID_NEAR*near +
-                                BOID_STEER*steer);
+                                BOID_STEER*steer +
+                                BOID_AVOID*avoid);
 
+  if constexpr (FLOCK_STATS)
+    pl->stats->local().add(boid.vel, num_nbs - 1); // nbs includes this boid
 }
 
-void move(Boid &boid) {
-  boid.pos += boid.vel;
-  if (boid.pos.x < -1.0f) {
-    boid.pos.x = -2.0f - boid.pos.x;
-    boid.vel.x = -boid.vel.x;
+
+void update_vel(Boid &boid, void *payload) {
+  // NOTE having a boid struct with pos and vel would be more elegant
+  auto pl = static_cast<update_vel_payload *>(payload);
+  if (skip_this_tick(boid, pl))
+    return;
+  auto index = pl->index;
+  glm::vec2 center(0.0f);
+  glm::vec2 near(0.0f);
+  glm::vec2 steer(0.0f);
+  size_t num_nbs = 0;
+
+  if constexpr (FAR_FIELD) {
+    // far cells as whole sums, the 3x3 block around us boid by boid
+    auto far = index->pyramid.far_field(boid.pos, FAR_SENSE_RAD);
+    center = far.pos;
+    steer = far.vel;
+    uint32_t count = far.count;
+    index->grid.for_each_near(boid.pos, [&](uint32_t i) {
+      const Boid &nb = index->snapshot[i];
+      glm::vec2 d = nb.pos - boid.pos;
+      if (glm::dot(d, d) < FAR_SENSE_RAD*FAR_SENSE_RAD) {
+        center += nb.pos;
+        steer += nb.vel;
+        ++count;
+      }
+      if (glm::dot(d, d) < SENSE_RAD*SENSE_RAD) {
+        near -= d;
+        ++num_nbs;
+      }
+    });
+    center = center - static_cast<float>(count)*boid.pos;
+  } else {
+    std::vector<Boid> nbs;
+    if (index->backend == IndexBackend::HASH)
+      nbs = neighbours(boid.pos, &index->spatial_hash);
+    else if (index->backend == IndexBackend::MULTI_GRID)
+      nbs = neighbours(boid.pos, SPECIES_SENSE_RAD[boid.species],
+                       &index->multi_grid, &index->snapshot);
+    else if (index->backend == IndexBackend::SPARSE_GRID)
+      nbs = neighbours(boid.pos, &index->sparse_grid, &index->snapshot);
+    else
+      nbs = neighbours(boid.pos, &index->grid, &index->snapshot);
+    num_nbs = nbs.size();
+
+    for (auto nb: nbs) {
+      center += nb.pos;
+      near -= nb.pos - boid.pos;
+    }
+    center = center - static_cast<float>(nbs.size())*boid.pos;
+
+    for (auto nb: nbs) {
+      steer += nb.vel;
+    }
   }
-  if (boid.pos.y < -1.0f) {
-    boid.pos.y = -2.0f - boid.pos.y;
-    boid.vel.y = -boid.vel.y;
+
+  apply_steering(boid, center, near, steer, num_nbs, pl);
+}
+
+
+void update_vel_contacts(Boid &boid, Contacts &contacts, void *payload) {
+  // same rules as update_vel, but the neighbour pass keeps the ids,
+  // and only what changed since last tick goes out as events; never
+  // subsampled (see the deadline controller in main), a skipped boid
+  // would diff against neighbours from ticks ago
+  auto pl = static_cast<update_vel_payload *>(payload);
+  auto index = pl->index;
+
+  thread_local std::vector<uint32_t> ids;
+  ids.clear();
+  auto visit = [&](uint32_t i) {
+    glm::vec2 d = index->snapshot[i].pos - boid.pos;
+    if (glm::dot(d, d) < SENSE_RAD*SENSE_RAD)
+      ids.push_back(i);
+  };
+  if (index->backend == IndexBackend::SPARSE_GRID)
+    index->sparse_grid.for_each_near(boid.pos, visit);
+  else
+    index->grid.for_each_near(boid.pos, visit);
+  std::sort(ids.begin(), ids.end());
+
+  glm::vec2 center(0.0f);
+  glm::vec2 near(0.0f);
+  glm::vec2 steer(0.0f);
+  for (uint32_t i: ids) {
+    const Boid &nb = index->snapshot[i];
+    center += nb.pos;
+    near -= nb.pos - boid.pos;
+    steer += nb.vel;
   }
-  if (boid.pos.x > 1.0f) {
-    boid.pos.x = 2.0f - boid.pos.x;
-    boid.vel.x = -boid.vel.x;
+  center = center - static_cast<float>(ids.size())*boid.pos;
+
+  auto &events = pl->contacts->local();
+  diff_neighbours(contacts.ids, ids, contacts.self, [&](uint32_t other, bool enter) {
+    events.push_back(ContactEvent{pl->tick, contacts.self, other, enter});
+  });
+  contacts.ids.swap(ids); // the old set becomes next boid's scratch space
+
+  apply_steering(boid, center, near, steer, contacts.ids.size(), pl);
+}
+
+
+void update_vel_multi_rate(Boid &boid, SlowSteer &slow, void *payload) {
+  // separation every tick within the small radius, the rest from the cache
+  auto pl = static_cast<update_vel_payload *>(payload);
+  if (skip_this_tick(boid, pl))
+    return;
+  auto index = pl->index;
+
+  auto s = multi_rate_steering(slow, boid.self, boid.pos, boid.vel, pl->tick, SLOW_EVERY,
+                               SENSE_RAD, NEAR_SENSE_RAD, [&](float radius, auto &&fn) {
+    index->grid.for_each_within(boid.pos, radius, [&](uint32_t i) {
+      const Boid &nb = index->snapshot[i];
+      fn(i, nb.pos, nb.vel);
+    });
+  });
+  apply_steering(boid, s.center, s.near, s.steer, s.count, pl);
+}
+
+struct move_payload {
+  const SDF *sdf;
+  SpatialIndex *index;
+};
+
+
+void move(Boid &boid, void *payload) {
+  auto pl = static_cast<move_payload *>(payload);
+  auto sdf = pl->sdf;
+  boid.pos += boid.vel;
+
+  // if we still ended up inside an obstacle, push out and bounce
+  auto obstacle = sdf->sample(boid.pos);
+  if (obstacle.dist < 0.0f) {
+    boid.pos -= obstacle.dist*obstacle.grad;
+    boid.vel -= 2.0f*glm::dot(boid.vel, obstacle.grad)*obstacle.grad;
   }
-  if (boid.pos.y > 1.0f) {
-    boid.pos.y = 2.0f - boid.pos.y;
-    boid.vel.y = -boid.vel.y;
+
+  if constexpr (!UNBOUNDED) {
+    if (boid.pos.x < -1.0f) {
+      boid.pos.x = -2.0f - boid.pos.x;
+      boid.vel.x = -boid.vel.x;
+    }
+    if (boid.pos.y < -1.0f) {
+      boid.pos.y = -2.0f - boid.pos.y;
+      boid.vel.y = -boid.vel.y;
+    }
+    if (boid.pos.x > 1.0f) {
+      boid.pos.x = 2.0f - boid.pos.x;
+      boid.vel.x = -boid.vel.x;
+    }
+    if (boid.pos.y > 1.0f) {
+      boid.pos.y = 2.0f - boid.pos.y;
+      boid.vel.y = -boid.vel.y;
+    }
   }
+
+  pl->index->moved(boid);
 }
 
 void update_posbuf(Boid &boid, Posbuf &posbuf) {
@@ -154,16 +562,22 @@ void update_posbuf(Boid &boid, Posbuf &posbuf) {
 }
 
 
-void draw(GLFWwindow *window, ecs::Component<Posbuf> &c_posbuf) {
+void draw(GLFWwindow *window, ecs::Component<Posbuf> &c_posbuf, PositionRing &ring) {
 
   glfwMakeContextCurrent(window);
   glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 
-  GLuint shader = load_shaders();
+  // the simulation writes into the ring itself, otherwise we copy
+  // out of c_posbuf and upload every frame
+  bool use_ring = PERSISTENT_RING && ring.create(NUM_BOIDS);
+  std::cout << "Render path: " << (use_ring ? "persistent ring" : "copy") << std::endl;
+
+  GLuint shader = load_shaders(use_ring);
   glUseProgram(shader);
   glDisable(GL_DEPTH_TEST);
+  GLint alpha_uniform = glGetUniformLocation(shader, "alpha");
 
-  std::vector<glm::vec2> boid_buffer(NUM_BOIDS);
+  std::vector<glm::vec2> boid_buffer(use_ring ? 0 : NUM_BOIDS);
 
   GLuint vao, vbo;
   glGenVertexArrays(1, &vao);
@@ -177,26 +591,48 @@ void draw(GLFWwindow *window, ecs::Component<Posbuf> &c_posbuf) {
   glEnableVertexAttribArray(0);
   glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2),
                         (void *)0);
+  if (use_ring)
+    glEnableVertexAttribArray(1);
 
   glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 
+  // pace ourselves instead of rendering as fast as we can
+  glfwSwapInterval(RENDER_FPS > 0.0 ? 0 : 1);
+  FramePacer pacer(RENDER_FPS > 0.0 ? RENDER_FPS : 1.0);
+  CpuMeter cpu;
+
   // for tracking graphics fps
   int frames = 0;
   double frame_start = glfwGetTime();
   double frame_time;
+  double feed_time = 0.0; // getting positions to the gpu, per frame
 
   double alpha {0.0};
 
   while (running.load()) {
 
+    double feed_start = glfwGetTime();
+    bool have_frame = true;
+    GLintptr prev_offset = 0, next_offset = 0;
+
     // harvest the interpolated positions
     {
       std::scoped_lock lock(triple_buffer_mutex);
-      alpha = (glfwGetTime() - next_tick_time) / LOGIC_DT; // FIXME may have glitches
-
-      for (int i = 0; i < NUM_BOIDS; ++i) {
-        boid_buffer[i] = glm::mix(c_posbuf.data[i].second.prev,
-                                  c_posbuf.data[i].second.next, alpha);
+      // we are one tick behind, going from the previous tick to the next
+      // over as long as they were apart; past that, hold the next one
+      // rather than run on beyond it and jump back when a tick comes in
+      double interval = next_tick_time - last_tick_time;
+      alpha = interval > 0.0
+        ? std::clamp((glfwGetTime() - next_tick_time) / interval, 0.0, 1.0)
+        : 1.0;
+
+      if (use_ring) {
+        have_frame = ring.begin_frame(prev_offset, next_offset);
+      } else {
+        for (int i = 0; i < NUM_BOIDS; ++i) {
+          boid_buffer[i] = glm::mix(c_posbuf.data[i].second.prev,
+                                    c_posbuf.data[i].second.next, alpha);
+        }
       }
     }
 
@@ -204,14 +640,31 @@ void draw(GLFWwindow *window, ecs::Component<Posbuf> &c_posbuf) {
     glUseProgram(shader);
     glClear(GL_COLOR_BUFFER_BIT);
 
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glm::vec2) * NUM_BOIDS,
-                    boid_buffer.data());
+    if (use_ring) {
+      glBindVertexArray(vao);
+      glBindBuffer(GL_ARRAY_BUFFER, ring.get_buffer());
+      glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2),
+                            (void *)prev_offset);
+      glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2),
+                            (void *)next_offset);
+      glUniform1f(alpha_uniform, alpha);
+    } else {
+      glBindBuffer(GL_ARRAY_BUFFER, vbo);
+      glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glm::vec2) * NUM_BOIDS,
+                      boid_buffer.data());
+    }
+    feed_time += glfwGetTime() - feed_start;
 
-    glBindVertexArray(vao);
-    glDrawArrays(GL_POINTS, 0, NUM_BOIDS);
+    if (have_frame) {
+      glBindVertexArray(vao);
+      glDrawArrays(GL_POINTS, 0, NUM_BOIDS);
+      if (use_ring)
+        ring.end_frame();
+    }
 
     glfwSwapBuffers(window);
+    if (RENDER_FPS > 0.0)
+      pacer.wait();
 
     frame_time = glfwGetTime();
     if (frame_time - frame_start > 1.0 || frames == 0) {
@@ -219,12 +672,17 @@ void draw(GLFWwindow *window, ecs::Component<Posbuf> &c_posbuf) {
       double frm_time =
           (frame_time - frame_start) / static_cast<double>(frames);
       frame_start = frame_time;
+      std::cout << "fps\t" << fps << "\tframe_time\t" << frm_time;
+      std::cout << "\tfeed\t" << (frames > 0 ? feed_time/frames : 0.0);
+      std::cout << "\tcpu\t" << cpu.usage() << std::endl;
       frames = 0;
-      std::cout << "fps\t" << fps << "\tframe_time\t" << frm_time << std::endl;
+      feed_time = 0.0;
     }
     ++frames;
   }
 
+  if (use_ring)
+    ring.destroy();
   glDeleteVertexArrays(1, &vao);
   glDeleteBuffers(1, &vbo);
 }
@@ -260,54 +718,218 @@ int main() {
   ecs::Component<Posbuf> c_posbuf; // locked by triple_buffer_mutex
   ecs::Component<Boid> c_boids;
 
+  ecs::Component<SlowSteer> c_slow; // only used with MULTI_RATE
+  ecs::Component<Contacts> c_contacts; // only used with CONTACT_EVENTS
+
   ecs.enlist(&c_posbuf);
   ecs.enlist(&c_boids);
+  ecs.enlist(&c_slow);
+  ecs.enlist(&c_contacts);
 
   // we haven't spawned the graphics thread yet
   // so we don't need any synchronization
   last_tick_time = glfwGetTime();
   next_tick_time = glfwGetTime();
 
-  std::mt19937 rng;
-  rng.seed(2701);
-  std::uniform_real_distribution<float> dist(-1.0, 1.0);
+  // random numbers are drawn in parallel, the same seed gives
+  // the same boids regardless of thread count
+  auto population = spawn_population(SPAWN_SEED, NUM_BOIDS, SPAWN);
 
   for (int i = 0; i < NUM_BOIDS; ++i) {
     auto id = ecs.get_id();
-    glm::vec2 pos(dist(rng), dist(rng));
-    glm::vec2 vel(dist(rng), dist(rng));
-    vel = glm::normalize(vel)*BOID_VEL;
-    c_boids.create(id, Boid{pos, vel});
+    glm::vec2 pos = population.pos[i];
+    glm::vec2 vel = population.vel[i]*BOID_VEL;
+    uint32_t species = i % SPECIES_SENSE_RAD.size();
+    c_boids.create(id, Boid{pos, vel, species, static_cast<uint32_t>(i)});
     c_posbuf.create(id, Posbuf{pos - vel, pos});
+    if (MULTI_RATE)
+      c_slow.create(id, make_slow_steer(pos, vel, i % SLOW_EVERY));
+    if (CONTACT_EVENTS)
+      c_contacts.create(id, Contacts{static_cast<uint32_t>(i), {}});
   }
   ecs.update();
 
-  // transfer graphics to separate thread
-  glfwMakeContextCurrent(nullptr);
-  std::thread draw_thread(&draw, window, std::ref(c_posbuf));
-
   double alpha;
 
   // for maintaining gameloop timestep
   double start_time = glfwGetTime();
   double accumulator = 0.0;
   double current_time;
+  double dropped = 0.0; // simulation time given up since the last report
+  double dropped_reported = 0.0;
 
   // for trackin the time taken
   // so we can optimize
   double logic_time = 0.0;
   double worst_logic_time = 0.0;
   int logic_ticks = 0;
+  CpuMeter main_cpu;
+  int total_ticks = 0;
+  size_t contact_events = 0;
+
+  // static obstacles, only rasterized once
+  std::vector<Obstacle> obstacles {
+    {Obstacle::CIRCLE, glm::vec2(-0.4f, 0.3f), glm::vec2(0.15f, 0.0f)},
+    {Obstacle::CIRCLE, glm::vec2(0.5f, -0.5f), glm::vec2(0.1f, 0.0f)},
+    {Obstacle::BOX, glm::vec2(0.3f, 0.4f), glm::vec2(0.05f, 0.25f)},
+  };
+  SDF sdf(-1.0f, 1.0f, SDF_RES);
+  sdf.rasterize(obstacles);
+
+  FlockStats stats;
+  std::ofstream stats_out;
+  if (FLOCK_STATS) {
+    stats_out.open(STATS_FILE);
+    write_header(stats_out);
+  }
 
-  std::unordered_multimap<int, Boid> spatial_hash;
+  // readers only ever see whole ticks, and never hold up this thread
+  std::unique_ptr<ShmWriter> shm;
+  std::vector<Boid> published;
+  if (SHM_PUBLISH) {
+    shm = std::make_unique<ShmWriter>(SHM_NAME, NUM_BOIDS, SENSE_RAD);
+    if (!shm->good())
+      std::cout << "Could not create shared memory " << SHM_NAME
+                << ", or another boids3 is writing it" << std::endl;
+  }
+
+  // the consumer runs on its own thread, the tick only hands over batches
+  std::ofstream contacts_out;
+  std::unique_ptr<ContactStream> contacts;
+  if (CONTACT_EVENTS) {
+    contacts_out.open(CONTACTS_FILE);
+    contacts_out << "tick\tboid\tother\tevent\n";
+    contacts = std::make_unique<ContactStream>([&](const std::vector<ContactEvent> &batch) {
+      for (auto &e: batch)
+        contacts_out << e;
+    });
+  }
+
+  // trades fidelity for time when ticks run long, see deadline.h;
+  // not with contact events, a boid left out of a tick would keep last
+  // tick's neighbours and report its changes late, or miss them
+  DeadlineController deadline(TICK_BUDGET, CONTACT_EVENTS
+                              ? std::span(FIDELITY_LADDER).first(1)
+                              : std::span<const Fidelity>(FIDELITY_LADDER));
+
+  // flock identification runs between ticks, while the ecs workers are idle
+  Pool cluster_pool;
+
+  // once every logic thread exists (the pool's and the contact consumer
+  // included), but before the draw thread does, so only they are counted
+  PerfCounters perf;
+  if (PERF_COUNTERS)
+    perf.attach();
+
+  // transfer graphics to separate thread
+  glfwMakeContextCurrent(nullptr);
+  PositionRing ring;
+  std::thread draw_thread(&draw, window, std::ref(c_posbuf), std::ref(ring));
+
+  // one logic tick, minus the bookkeeping
+  uint32_t step_tick = 0;
+  auto step = [&](SpatialIndex &index) {
+    // first build our spatial index
+    index.rebuild(c_boids);
+    perf.mark("hash");
+
+    // then update all the boids
+    update_vel_payload uv_payload(&index, &sdf, &stats, step_tick++, contacts.get(),
+                                  deadline.fidelity());
+    if constexpr (CONTACT_EVENTS)
+      ecs.apply(&update_vel_contacts, c_boids, c_contacts, static_cast<void *>(&uv_payload));
+    else if constexpr (MULTI_RATE)
+      ecs.apply(&update_vel_multi_rate, c_boids, c_slow, static_cast<void *>(&uv_payload));
+    else
+      ecs.apply(&update_vel, c_boids, static_cast<void *>(&uv_payload));
+    // move writes the snapshot update_vel reads, so it can't start early
+    ecs.wait();
+    perf.mark("update_vel");
+    move_payload mv_payload {&sdf, &index};
+    ecs.apply(&move, c_boids, static_cast<void *>(&mv_payload));
+    ecs.wait();
+    index.mark_moved();
+    perf.mark("move");
+  };
+
+  auto index = std::make_unique<SpatialIndex>(INDEX_BACKEND,
+                                              MULTI_RATE ? NEAR_SENSE_RAD : SENSE_RAD);
+
+  // mixed radii only work with the multi level grid, and the far field
+  // needs one of the single level ones, so there's nothing to pick then
+  if (AUTO_TUNE && SPECIES_SENSE_RAD.size() == 1) {
+    std::stringstream workload;
+    workload << "boids3 n=" << NUM_BOIDS << " r=" << SENSE_RAD << " far=" << FAR_FIELD
+             << " unbounded=" << UNBOUNDED << " multi_rate=" << MULTI_RATE;
+    AutoTuner tuner(cache_path(TUNE_CACHE), workload.str());
+
+    std::vector<TuneChoice> candidates;
+    if (UNBOUNDED) {
+      // only the sparse grid covers the whole world
+      for (float scale: {1.0f, 1.5f, 2.0f})
+        candidates.push_back({static_cast<int>(IndexBackend::SPARSE_GRID), scale});
+    } else {
+      if (!FAR_FIELD && !MULTI_RATE && !CONTACT_EVENTS)
+        candidates.push_back({static_cast<int>(IndexBackend::HASH), 1.0f});
+      for (auto backend: {IndexBackend::GRID, IndexBackend::GRID_INCREMENTAL}) {
+        // multi rate only does radius queries, so cells can be smaller
+        if (MULTI_RATE)
+          candidates.push_back({static_cast<int>(backend), NEAR_SENSE_RAD/SENSE_RAD});
+        for (float scale: {1.0f, 1.5f, 2.0f})
+          candidates.push_back({static_cast<int>(backend), scale});
+      }
+    }
+
+    TuneChoice choice;
+    if (!tuner.load(candidates, choice)) {
+      // trials tick the real components, which are put back as spawned
+      // after each one, so the simulation proper starts from the same state
+      auto spawned_boids = c_boids.data;
+      auto spawned_slow = c_slow.data;
+      auto spawned_contacts = c_contacts.data;
+      choice = tuner.search(candidates, [&](const TuneChoice &c) {
+        SpatialIndex trial(static_cast<IndexBackend>(c.backend), c.cell_scale*SENSE_RAD);
+        step(trial);
+        double start = glfwGetTime();
+        for (int i = 0; i < TUNE_TICKS; ++i)
+          step(trial);
+        double time = (glfwGetTime() - start)/TUNE_TICKS;
+        c_boids.data = spawned_boids;
+        c_slow.data = spawned_slow;
+        c_contacts.data = spawned_contacts;
+        step_tick = 0;
+        return time;
+      });
+      if constexpr (FLOCK_STATS)
+        stats.reduce(); // drop whatever the trials accumulated
+      if (contacts)
+        contacts->discard();
+    }
+    std::cout << "Using index backend " << choice.backend
+              << " with cells of " << choice.cell_scale << "*SENSE_RAD" << std::endl;
+    index = std::make_unique<SpatialIndex>(static_cast<IndexBackend>(choice.backend),
+                                           choice.cell_scale*SENSE_RAD);
+  }
+
+  std::signal(SIGINT, on_interrupt);
+  std::signal(SIGTERM, on_interrupt);
 
-  while (!glfwWindowShouldClose(window)) {
+  while (!glfwWindowShouldClose(window) && !interrupted) {
 
     current_time = glfwGetTime();
     double time_diff = current_time - start_time;
     accumulator += time_diff;
-    if (accumulator > 0.5) {
-      accumulator = 0.5;
+    if (accumulator > MAX_BACKLOG) {
+      // the deadline controller should keep us from getting here,
+      // but a stall (or a debugger) can still put us too far behind;
+      // a long one would get here every time round, so report once a second
+      dropped += accumulator - MAX_BACKLOG;
+      accumulator = MAX_BACKLOG;
+      if (current_time - dropped_reported >= 1.0) {
+        std::cout << "Dropped " << dropped << "s of simulation time" << std::endl;
+        dropped = 0.0;
+        dropped_reported = current_time;
+      }
     }
 
     start_time = glfwGetTime();
@@ -318,36 +940,98 @@ int main() {
 
       auto logic_timer = [start = glfwGetTime()]{ return glfwGetTime() - start; };
 
+      perf.begin();
+
       // logic here
-      // first build our spatial hash
-      spatial_hash.clear();
-      for (auto [id, boid]: c_boids.data) {
-        spatial_hash.insert(std::make_pair(hashable(boid.pos), boid));
+      step(*index);
+
+      // only the step is up to the deadline controller, none of the
+      // passes below get any cheaper at a lower fidelity
+      double step_time = logic_timer();
+
+      if constexpr (FLOCK_STATS)
+        stats_out << stats.reduce();
+
+      if (contacts) {
+        contact_events += contacts->flush();
+        perf.mark("contacts");
       }
 
-      // then update all the boids
-      ecs.apply(&update_vel, c_boids, static_cast<void *>(&spatial_hash));
-      ecs.apply(&move, c_boids);
-      ecs.wait();
+      if (CLUSTER_EVERY > 0 && total_ticks % CLUSTER_EVERY == 0) {
+        auto flocks = find_flocks(*index, c_boids, cluster_pool);
+        uint32_t largest = 0;
+        for (auto &cl: flocks.clusters)
+          largest = std::max(largest, cl.size);
+        std::cout << "Flocks: " << flocks.clusters.size();
+        std::cout << "\tLargest: " << largest << std::endl;
+        perf.mark("flocks");
+      }
+
+      // with the ring up, positions go straight to the gpu's memory,
+      // written outside the lock so the draw thread isn't held up; when
+      // the gpu still holds every slot the tick just isn't shown, waiting
+      // for one would count against the tick's budget
+      glm::vec2 *slot = ring.acquire();
+      if (slot) {
+        glm::vec2 *out = slot;
+        for (auto &[id, boid]: c_boids.data)
+          *out++ = boid.pos;
+      }
 
       {
         std::scoped_lock lock(triple_buffer_mutex);
-        last_tick_time = next_tick_time;
-        next_tick_time = glfwGetTime();
+        // the times go with the positions the draw thread interpolates,
+        // so they only move on when this tick is actually handed over
+        bool handed_over = slot || !ring.up();
+        if (handed_over) {
+          last_tick_time = next_tick_time;
+          next_tick_time = glfwGetTime();
+        }
+
+        if (slot) {
+          ring.publish();
+        } else if (handed_over) {
+          ecs.apply(&update_posbuf, c_boids, c_posbuf);
+          ecs.wait();
+        }
+        perf.mark("posbuf");
+      }
 
-        ecs.apply(&update_posbuf, c_boids, c_posbuf);
-        ecs.wait();
+      if (shm) {
+        published.clear();
+        for (auto &[id, boid]: c_boids.data)
+          published.push_back(boid);
+        shm->publish(total_ticks, published);
+        perf.mark("shm");
       }
 
       accumulator -= LOGIC_DT;
 
-      logic_time += logic_timer();
-      worst_logic_time = std::max(logic_timer(), worst_logic_time);
+      double tick_time = logic_timer();
+      logic_time += tick_time;
+      worst_logic_time = std::max(tick_time, worst_logic_time);
+
+      if (int change = deadline.record(step_time)) {
+        std::cout << "Deadline: p99 " << deadline.get_decided_p99()
+                  << (change < 0 ? " over " : " well under ") << deadline.get_budget()
+                  << ", now level " << deadline.get_level()
+                  << " (" << deadline.fidelity() << ")" << std::endl;
+      }
       ++logic_ticks;
+      ++total_ticks;
 
       if (logic_ticks == 9) {
         std::cout << "Averageg logic step: " << logic_time/10.0;
-        std::cout << "\tWorst: " << worst_logic_time << std::endl;
+        std::cout << "\tWorst: " << worst_logic_time;
+        std::cout << "\tMain cpu: " << main_cpu.usage();
+        std::cout << "\tFidelity: " << deadline.get_level();
+        if (CONTACT_EVENTS)
+          std::cout << "\tContact events: " << contact_events
+                    << "\tDropped: " << contacts->get_dropped();
+        if (ring.up())
+          std::cout << "\tTicks not shown: " << ring.get_skipped();
+        std::cout << std::endl;
+        contact_events = 0;
         logic_ticks = 0;
         logic_time = 0.0;
         worst_logic_time = 0.0;
@@ -359,11 +1043,16 @@ int main() {
 
     // what goes here? input?
 
+    // sleep (still handling events) until the next tick is due
+    wait_events_until(start_time + LOGIC_DT - accumulator);
+
   }
 
   running.store(false);
   draw_thread.join();
 
+  perf.report(static_cast<uint64_t>(total_ticks)*NUM_BOIDS);
+
   // end program section
 
   glfwTerminate();
@@ -0,0 +1,63 @@
+#ifndef __MULTIGRID_H__
+#define __MULTIGRID_H__
+
+
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "grid.h"
+
+
+// One Grid per perception radius. Every level holds every boid (a boid
+// with a small radius is still a neighbour of one with a large radius),
+// and a query only walks the level sized for its own radius, so a small
+// radius boid looks at a few small cells instead of whole cells sized
+// for the largest radius. The price is building every level each time,
+// which with a handful of species is cheap next to the queries.
+
+
+class MultiGrid {
+public:
+  MultiGrid(float lo, float hi, const std::vector<float> &radii)
+    : radii(radii) {
+    for (float r: radii) {
+      levels.emplace_back(lo, hi, r);
+    }
+  }
+
+  template <typename T>
+  void build(const std::vector<T> &items) {
+    // items need a position_of() overload
+    for (auto &level: levels)
+      level.build(items);
+  }
+
+  template <typename F>
+  void for_each_within(glm::vec2 p, float radius, F &&fn) const {
+    // fn(index) for every candidate in range,
+    // the caller still does the distance check
+    levels[level_for(radius)].for_each_within(p, radius, fn);
+  }
+
+private:
+  size_t level_for(float radius) const {
+    // the finest level with cells at least radius wide,
+    // or the coarsest if there is none
+    size_t best = levels.size(), coarsest = 0;
+    for (size_t l = 0; l < levels.size(); ++l) {
+      if (radii[l] >= radius && (best == levels.size() || radii[l] < radii[best]))
+        best = l;
+      if (radii[l] > radii[coarsest])
+        coarsest = l;
+    }
+    return best < levels.size() ? best : coarsest;
+  }
+
+  std::vector<float> radii;
+  std::vector<Grid> levels;
+};
+
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef __MULTIRATE_H__
+#define __MULTIRATE_H__
+
+
+#include <cstdint>
+
+#include "glm/glm.hpp"
+
+
+// Multi rate steering: cohesion and alignment are refreshed every few
+// ticks, each tick for a different share of the boids, and cached in
+// between; separation runs every tick, but only looks within a small
+// radius and takes the ring beyond it from the cache. Shared by boids3
+// and World, so bench_multirate measures the rules boids3 runs.
+//
+// The cache holds the other boids only. Our own position and velocity
+// change every tick and enter live, so every sum below is the one the
+// full rules would take over the cached neighbour set, carried along at
+// the neighbours' mean velocity.
+
+
+struct SlowSteer {
+  // the other neighbours as of the last refresh
+  glm::vec2 centroid; // their mean position
+  glm::vec2 heading; // their mean velocity
+  glm::vec2 ring; // mean position of those beyond the near radius
+  glm::vec2 ring_vel; // and their mean velocity
+  uint32_t count;
+  uint32_t ring_count;
+  uint32_t refreshed; // tick of the last refresh
+  uint32_t phase; // refreshed on ticks where (tick + phase) % every == 0
+};
+
+
+struct Steering {
+  // the same sums as the full rules, count includes ourselves
+  glm::vec2 center;
+  glm::vec2 near;
+  glm::vec2 steer;
+  uint32_t count;
+};
+
+
+inline SlowSteer make_slow_steer(glm::vec2 pos, glm::vec2 vel, uint32_t phase) {
+  // nobody around until the first refresh
+  return SlowSteer{pos, vel, pos, vel, 0, 0, 0, phase};
+}
+
+
+template <typename Visit>
+Steering multi_rate_steering(SlowSteer &slow, uint32_t self, glm::vec2 pos, glm::vec2 vel,
+                             uint32_t tick, uint32_t every, float sense_rad, float near_rad,
+                             Visit &&visit) {
+  // visit(radius, fn) calls fn(index, pos, vel) for every boid that may be
+  // within radius of pos, self is our own index
+  if ((tick + slow.phase) % every == 0) {
+    glm::vec2 sum(0.0f), heading(0.0f), ring_sum(0.0f), ring_vel(0.0f);
+    uint32_t count = 0, ring_count = 0;
+    visit(sense_rad, [&](uint32_t i, glm::vec2 other, glm::vec2 other_vel) {
+      glm::vec2 d = other - pos;
+      float d2 = glm::dot(d, d);
+      if (i == self || d2 >= sense_rad*sense_rad) return;
+      sum += other;
+      heading += other_vel;
+      ++count;
+      if (d2 >= near_rad*near_rad) {
+        ring_sum += other;
+        ring_vel += other_vel;
+        ++ring_count;
+      }
+    });
+    slow.centroid = count > 0 ? sum/static_cast<float>(count) : pos;
+    slow.heading = count > 0 ? heading/static_cast<float>(count) : glm::vec2(0.0f);
+    slow.ring = ring_count > 0 ? ring_sum/static_cast<float>(ring_count) : pos;
+    slow.ring_vel = ring_count > 0 ? ring_vel/static_cast<float>(ring_count) : glm::vec2(0.0f);
+    slow.count = count;
+    slow.ring_count = ring_count;
+    slow.refreshed = tick;
+  }
+
+  // neighbours mostly travel with us, so the cached means are carried
+  // along at their mean velocity rather than left where they were
+  float age = static_cast<float>(tick - slow.refreshed);
+  glm::vec2 centroid = slow.centroid + age*slow.heading;
+  glm::vec2 ring = slow.ring + age*slow.ring_vel;
+
+  Steering s;
+  s.count = slow.count + 1;
+  s.center = static_cast<float>(slow.count)*(centroid - pos);
+  s.steer = static_cast<float>(slow.count)*slow.heading + vel;
+
+  // separation exact within near_rad, from the cache for the ring beyond
+  s.near = -static_cast<float>(slow.ring_count)*(ring - pos);
+  visit(near_rad, [&](uint32_t, glm::vec2 other, glm::vec2) {
+    glm::vec2 d = other - pos;
+    if (glm::dot(d, d) < near_rad*near_rad)
+      s.near -= d;
+  });
+  return s;
+}
+
+
+#endif
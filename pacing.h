@@ -0,0 +1,87 @@
+#ifndef __PACING_H__
+#define __PACING_H__
+
+
+#include <chrono>
+#include <thread>
+
+#include <time.h>
+
+#include "GLFW/glfw3.h"
+
+
+// Sleeping instead of spinning. Both waits sleep until shortly before
+// the deadline and spin the last SPIN_MARGIN, since a sleep can
+// overshoot by a scheduler quantum but a short spin can't.
+
+
+constexpr double SPIN_MARGIN = 0.001; // seconds
+
+
+inline void wait_events_until(double deadline) {
+  // main thread, keeps handling window events while it waits for the tick
+  while (true) {
+    double remaining = deadline - glfwGetTime();
+    if (remaining <= SPIN_MARGIN) break;
+    glfwWaitEventsTimeout(remaining - SPIN_MARGIN);
+  }
+  while (glfwGetTime() < deadline) {}
+}
+
+
+class FramePacer {
+public:
+  explicit FramePacer(double rate)
+    : period(1.0/rate)
+    , deadline(glfwGetTime() + period) {
+  }
+
+  void wait() {
+    // sleep until the next frame is due, if we're more than a frame
+    // behind just start over instead of rendering a burst to catch up
+    double now = glfwGetTime();
+    if (now > deadline + period)
+      deadline = now;
+    double remaining = deadline - now;
+    if (remaining > SPIN_MARGIN)
+      std::this_thread::sleep_for(std::chrono::duration<double>(remaining - SPIN_MARGIN));
+    while (glfwGetTime() < deadline) {}
+    deadline += period;
+  }
+
+private:
+  const double period;
+  double deadline;
+};
+
+
+class CpuMeter {
+public:
+  // fraction of one core the calling thread used since the last call
+  CpuMeter()
+    : wall(glfwGetTime())
+    , cpu(thread_cpu()) {
+  }
+
+  double usage() {
+    double now_wall = glfwGetTime();
+    double now_cpu = thread_cpu();
+    double result = now_wall > wall ? (now_cpu - cpu)/(now_wall - wall) : 0.0;
+    wall = now_wall;
+    cpu = now_cpu;
+    return result;
+  }
+
+private:
+  static double thread_cpu() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+  }
+
+  double wall;
+  double cpu;
+};
+
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef __PERFCOUNT_H__
+#define __PERFCOUNT_H__
+
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+// Hardware counters per tick phase. Counters are opened on every thread
+// that exists when attach() is called (the ecs worker pool included),
+// summed over threads, and the difference between two mark() calls is
+// attributed to the named phase. If the kernel won't give us counters
+// everything here turns into a no-op.
+
+
+enum PerfEvent {
+  CYCLES,
+  INSTRUCTIONS,
+  L1D_MISSES,
+  LLC_MISSES,
+  BRANCH_MISSES,
+  DTLB_MISSES,
+  NUM_PERF_EVENTS
+};
+
+using PerfValues = std::array<uint64_t, NUM_PERF_EVENTS>;
+
+
+inline int open_counter(pid_t tid, uint32_t type, uint64_t config) {
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return syscall(SYS_perf_event_open, &attr, tid, -1, -1, 0);
+}
+
+
+inline uint64_t cache_config(uint64_t cache, uint64_t op, uint64_t result) {
+  return cache | (op << 8) | (result << 16);
+}
+
+
+class PerfCounters {
+public:
+  ~PerfCounters() {
+    for (auto &thread: fds)
+      for (int fd: thread)
+        if (fd >= 0) close(fd);
+  }
+
+  bool attach() {
+    // one set of counters for every thread currently in the process
+    const std::array<std::pair<uint32_t, uint64_t>, NUM_PERF_EVENTS> events {{
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+      {PERF_TYPE_HW_CACHE, cache_config(PERF_COUNT_HW_CACHE_L1D,
+                                        PERF_COUNT_HW_CACHE_OP_READ,
+                                        PERF_COUNT_HW_CACHE_RESULT_MISS)},
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+      {PERF_TYPE_HW_CACHE, cache_config(PERF_COUNT_HW_CACHE_DTLB,
+                                        PERF_COUNT_HW_CACHE_OP_READ,
+                                        PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    }};
+
+    std::error_code ec;
+    for (auto &task: std::filesystem::directory_iterator("/proc/self/task", ec)) {
+      pid_t tid = std::stoi(task.path().filename().string());
+      std::array<int, NUM_PERF_EVENTS> thread;
+      for (int e = 0; e < NUM_PERF_EVENTS; ++e) {
+        thread[e] = open_counter(tid, events[e].first, events[e].second);
+        available[e] = available[e] || thread[e] >= 0;
+      }
+      fds.push_back(thread);
+    }
+
+    enabled = false;
+    for (bool a: available)
+      enabled = enabled || a;
+    if (!enabled)
+      std::cout << "perf counters unavailable, check perf_event_paranoid" << std::endl;
+    last = read();
+    return enabled;
+  }
+
+  void begin() {
+    // start of a stretch we care about, drops whatever happened since last
+    if (enabled) last = read();
+  }
+
+  void mark(const std::string &phase) {
+    // everything since the previous mark/begin goes to this phase
+    if (!enabled) return;
+    PerfValues now = read();
+    size_t p = 0;
+    while (p < phases.size() && phases[p] != phase) ++p;
+    if (p == phases.size()) {
+      phases.push_back(phase);
+      totals.push_back(PerfValues {});
+    }
+    for (int e = 0; e < NUM_PERF_EVENTS; ++e)
+      totals[p][e] += now[e] > last[e] ? now[e] - last[e] : 0; // scaling can wobble
+    last = now;
+  }
+
+  void report(uint64_t boid_ticks) const {
+    if (!enabled) return;
+    const char *names[NUM_PERF_EVENTS] = {"cycles", "instr", "L1d", "LLC", "branch", "dTLB"};
+    double per = boid_ticks > 0 ? static_cast<double>(boid_ticks) : 1.0;
+    std::cout << "phase\tIPC";
+    for (int e = 0; e < NUM_PERF_EVENTS; ++e)
+      std::cout << '\t' << names[e] << "/boid";
+    std::cout << std::endl;
+    for (size_t p = 0; p < phases.size(); ++p) {
+      double ipc = totals[p][CYCLES] > 0
+        ? static_cast<double>(totals[p][INSTRUCTIONS])/totals[p][CYCLES] : 0.0;
+      std::cout << phases[p] << '\t' << std::setprecision(3) << ipc;
+      for (int e = 0; e < NUM_PERF_EVENTS; ++e) {
+        if (available[e]) std::cout << '\t' << totals[p][e]/per;
+        else std::cout << "\t-";
+      }
+      std::cout << std::endl;
+    }
+  }
+
+private:
+  PerfValues read() const {
+    // summed over threads, scaled up if the pmu was multiplexed
+    PerfValues sum {};
+    for (auto &thread: fds) {
+      for (int e = 0; e < NUM_PERF_EVENTS; ++e) {
+        if (thread[e] < 0) continue;
+        uint64_t buf[3];
+        if (::read(thread[e], buf, sizeof(buf)) != sizeof(buf) || buf[2] == 0) continue;
+        sum[e] += static_cast<uint64_t>(static_cast<double>(buf[0])*buf[1]/buf[2]);
+      }
+    }
+    return sum;
+  }
+
+  bool enabled = false;
+  std::array<bool, NUM_PERF_EVENTS> available {};
+  std::vector<std::array<int, NUM_PERF_EVENTS>> fds;
+  PerfValues last {};
+
+  std::vector<std::string> phases;
+  std::vector<PerfValues> totals;
+};
+
+
+#endif
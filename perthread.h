@@ -0,0 +1,68 @@
+#ifndef __PERTHREAD_H__
+#define __PERTHREAD_H__
+
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+// One T for every thread that asks for it, registered on first use, so
+// workers write to their own without locking and the owner visits them
+// all once the workers are done (after ecs.wait() or a pool run).
+//
+// A thread remembers the last instance it used by serial rather than by
+// address, since one of these can be destroyed and the next one made in
+// its place. Switching between live instances only costs a lookup, a
+// thread never gets a second T from the same instance.
+
+
+template <typename T>
+class PerThread {
+public:
+  PerThread() = default;
+
+  PerThread(const PerThread &) = delete;
+
+  T &local() {
+    thread_local uint64_t owner = 0;
+    thread_local T *mine = nullptr;
+    if (owner != serial) {
+      mine = &find_or_add();
+      owner = serial;
+    }
+    return *mine;
+  }
+
+  template <typename F>
+  void for_each(F &&fn) {
+    // fn(T &) on every thread's T, call when no thread is writing to them
+    std::scoped_lock lock(mutex);
+    for (auto &[id, t]: items)
+      fn(*t);
+  }
+
+private:
+  T &find_or_add() {
+    auto me = std::this_thread::get_id();
+    std::scoped_lock lock(mutex);
+    for (auto &[id, t]: items)
+      if (id == me)
+        return *t;
+    items.emplace_back(me, std::make_unique<T>());
+    return *items.back().second;
+  }
+
+  static inline std::atomic<uint64_t> next_serial {1};
+  const uint64_t serial = next_serial++;
+
+  std::mutex mutex;
+  std::vector<std::pair<std::thread::id, std::unique_ptr<T>>> items;
+};
+
+
+#endif
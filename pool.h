@@ -0,0 +1,99 @@
+#ifndef __POOL_H__
+#define __POOL_H__
+
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// A fork-join pool whose threads live as long as it does, for work that
+// runs inside the tick outside of ecs.apply (which has no notion of an
+// index), so it doesn't pay for creating threads on every call.
+
+
+class Pool {
+public:
+  explicit Pool(unsigned num_threads = std::thread::hardware_concurrency())
+    : num_threads(std::max(num_threads, 1u)) {
+    for (unsigned t = 1; t < this->num_threads; ++t)
+      threads.emplace_back(&Pool::work, this, t);
+  }
+
+  Pool(const Pool &) = delete;
+
+  ~Pool() {
+    {
+      std::scoped_lock lock(mutex);
+      stopping = true;
+    }
+    start.notify_all();
+    for (auto &t: threads)
+      t.join();
+  }
+
+  unsigned size() const { return num_threads; }
+
+  void run(const std::function<void(unsigned)> &fn) {
+    // fn(t) on every thread t of the pool, the caller being thread 0,
+    // returns once all of them have
+    {
+      std::scoped_lock lock(mutex);
+      job = &fn;
+      pending = num_threads - 1;
+      ++generation;
+    }
+    start.notify_all();
+    fn(0);
+    std::unique_lock lock(mutex);
+    done.wait(lock, [&] { return pending == 0; });
+    job = nullptr;
+  }
+
+  template <typename F>
+  void for_range(uint32_t count, F &&fn) {
+    // fn(begin, end) over an even split of [0, count)
+    uint32_t chunk = (count + num_threads - 1)/num_threads;
+    run([&](unsigned t) {
+      uint32_t begin = std::min<uint64_t>(uint64_t(t)*chunk, count);
+      uint32_t end = std::min<uint64_t>(uint64_t(begin) + chunk, count);
+      if (begin < end)
+        fn(begin, end);
+    });
+  }
+
+private:
+  void work(unsigned t) {
+    uint64_t seen = 0;
+    std::unique_lock lock(mutex);
+    while (true) {
+      start.wait(lock, [&] { return stopping || generation != seen; });
+      if (stopping) return;
+      seen = generation;
+      auto fn = job;
+      lock.unlock();
+      (*fn)(t);
+      lock.lock();
+      if (--pending == 0)
+        done.notify_one();
+    }
+  }
+
+  const unsigned num_threads;
+  std::vector<std::thread> threads;
+
+  std::mutex mutex;
+  std::condition_variable start;
+  std::condition_variable done;
+  const std::function<void(unsigned)> *job = nullptr;
+  unsigned pending = 0;
+  uint64_t generation = 0;
+  bool stopping = false;
+};
+
+
+#endif
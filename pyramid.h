@@ -0,0 +1,121 @@
+#ifndef __PYRAMID_H__
+#define __PYRAMID_H__
+
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "grid.h"
+
+
+// Per-cell sums of position and velocity on top of a Grid, plus coarser
+// levels that each merge 2x2 cells of the one below. Cohesion and
+// alignment only need those sums, so for a large perception radius the
+// cells far from a boid can be taken whole (Barnes-Hut style) and only
+// the 3x3 block around it has to be visited boid by boid.
+
+
+struct Aggregate {
+  uint32_t count = 0;
+  glm::vec2 pos {0.0f, 0.0f};
+  glm::vec2 vel {0.0f, 0.0f};
+
+  void add(const Aggregate &o) {
+    count += o.count;
+    pos += o.pos;
+    vel += o.vel;
+  }
+};
+
+
+class Pyramid {
+public:
+  explicit Pyramid(const Grid &grid)
+    : grid(grid) {
+    int d = grid.get_dim();
+    while (true) {
+      dims.push_back(d);
+      levels.emplace_back(d*d);
+      if (d == 1) break;
+      d = (d + 1)/2;
+    }
+  }
+
+  template <typename T>
+  void build(const std::vector<T> &items) {
+    // items need position_of() and velocity_of() overloads
+    for (auto &level: levels)
+      std::fill(level.begin(), level.end(), Aggregate());
+
+    for (auto &item: items) {
+      auto &a = levels[0][grid.cell_of(position_of(item))];
+      ++a.count;
+      a.pos += position_of(item);
+      a.vel += velocity_of(item);
+    }
+
+    for (size_t l = 1; l < levels.size(); ++l) {
+      int d = dims[l - 1];
+      for (int y = 0; y < d; ++y)
+        for (int x = 0; x < d; ++x)
+          levels[l][(y/2)*dims[l] + x/2].add(levels[l - 1][y*d + x]);
+    }
+  }
+
+  Aggregate far_field(glm::vec2 p, float radius) const {
+    // everything within radius of p, except the 3x3 base cells around p
+    // which the caller is expected to do exactly
+    Aggregate result;
+    int c = grid.cell_of(p);
+    int cx = c % dims[0], cy = c / dims[0];
+    visit(levels.size() - 1, 0, 0, p, radius, cx, cy, result);
+    return result;
+  }
+
+private:
+  void visit(int l, int x, int y, glm::vec2 p, float radius,
+             int cx, int cy, Aggregate &result) const {
+    const Aggregate &a = levels[l][y*dims[l] + x];
+    if (a.count == 0) return;
+
+    // bounds of the cell, in base cells and in world coordinates
+    int bx0 = x << l, bx1 = ((x + 1) << l) - 1;
+    int by0 = y << l, by1 = ((y + 1) << l) - 1;
+    float size = grid.get_cell_size();
+    glm::vec2 lo(grid.get_lo() + bx0*size, grid.get_lo() + by0*size);
+    glm::vec2 hi(grid.get_lo() + (bx1 + 1)*size, grid.get_lo() + (by1 + 1)*size);
+
+    glm::vec2 nearest = glm::clamp(p, lo, hi);
+    if (glm::dot(nearest - p, nearest - p) > radius*radius) return;
+
+    bool overlaps_near = bx0 <= cx + 1 && bx1 >= cx - 1 && by0 <= cy + 1 && by1 >= cy - 1;
+    if (l == 0) {
+      // partially covered base cells count if their center is inside
+      glm::vec2 mid = 0.5f*(lo + hi);
+      if (!overlaps_near && glm::dot(mid - p, mid - p) <= radius*radius)
+        result.add(a);
+      return;
+    }
+
+    glm::vec2 farthest(std::max(std::abs(lo.x - p.x), std::abs(hi.x - p.x)),
+                       std::max(std::abs(lo.y - p.y), std::abs(hi.y - p.y)));
+    if (!overlaps_near && glm::dot(farthest, farthest) <= radius*radius) {
+      result.add(a);
+      return;
+    }
+
+    for (int j = 2*y; j <= std::min(2*y + 1, dims[l - 1] - 1); ++j)
+      for (int i = 2*x; i <= std::min(2*x + 1, dims[l - 1] - 1); ++i)
+        visit(l - 1, i, j, p, radius, cx, cy, result);
+  }
+
+  const Grid &grid;
+  std::vector<int> dims;
+  std::vector<std::vector<Aggregate>> levels;
+};
+
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef __RASTER_H__
+#define __RASTER_H__
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "pool.h"
+
+
+// CPU rendering for machines without a GPU. The image is split into
+// horizontal bands; boids are first binned by band (each thread bins its
+// own share of the boids), then each thread draws the bands it owns, so
+// no two threads ever write the same pixel. The threads are the caller's
+// pool, which the rasterizer may share with the simulation.
+
+
+constexpr int GLYPH_PX = 4; // length of a velocity glyph in pixels
+constexpr uint8_t BOID_LUMA = 96; // added per boid, saturating
+
+
+class Rasterizer {
+public:
+  Rasterizer(int width, int height, float lo, float hi, Pool &pool)
+    : width(width)
+    , height(height)
+    , lo(lo)
+    , scale(width/(hi - lo))
+    , pool(pool)
+    , num_threads(pool.size())
+    , num_bands(4*this->num_threads)
+    , band_rows((height + num_bands - 1)/num_bands)
+    , luma(width*height)
+    , bins(this->num_threads*num_bands) {
+  }
+
+  void render(const std::vector<glm::vec2> &pos,
+              const std::vector<glm::vec2> *vel = nullptr) {
+    // vel, if given, turns points into short lines pointing backwards
+    // along the velocity
+    pool.run([&](unsigned t) {
+      size_t chunk = (pos.size() + num_threads - 1)/num_threads;
+      size_t start = std::min(t*chunk, pos.size());
+      size_t end = std::min(start + chunk, pos.size());
+      for (int b = 0; b < num_bands; ++b)
+        bins[t*num_bands + b].clear();
+      for (size_t i = start; i < end; ++i) {
+        // a glyph can reach GLYPH_PX rows past its boid
+        float y = to_pixel(pos[i]).y;
+        int reach = vel ? GLYPH_PX : 0;
+        int b0 = std::clamp(static_cast<int>(y) - reach, 0, height - 1)/band_rows;
+        int b1 = std::clamp(static_cast<int>(y) + reach, 0, height - 1)/band_rows;
+        for (int b = b0; b <= b1; ++b)
+          bins[t*num_bands + b].push_back(i);
+      }
+    });
+
+    pool.run([&](unsigned t) {
+      for (int b = t; b < num_bands; b += num_threads) {
+        int row0 = b*band_rows;
+        int row1 = std::min(row0 + band_rows, height);
+        std::fill(luma.begin() + row0*width, luma.begin() + row1*width, 0);
+        for (unsigned s = 0; s < num_threads; ++s) {
+          for (uint32_t i: bins[s*num_bands + b]) {
+            glm::vec2 p = to_pixel(pos[i]);
+            if (!vel) {
+              plot(p, row0, row1);
+              continue;
+            }
+            glm::vec2 d = glm::dot((*vel)[i], (*vel)[i]) > 0.0f
+              ? glm::normalize((*vel)[i]) : glm::vec2(0.0f);
+            d.y = -d.y; // image rows go down
+            for (int k = 0; k < GLYPH_PX; ++k)
+              plot(p - static_cast<float>(k)*d, row0, row1);
+          }
+        }
+      }
+    });
+  }
+
+  const std::vector<uint8_t> &get_luma() const { return luma; }
+
+private:
+  glm::vec2 to_pixel(glm::vec2 p) const {
+    // world y points up, image rows go down
+    return glm::vec2((p.x - lo)*scale, height - (p.y - lo)*scale);
+  }
+
+  void plot(glm::vec2 p, int row0, int row1) {
+    int x = static_cast<int>(p.x);
+    int y = static_cast<int>(p.y);
+    if (x < 0 || x >= width || y < row0 || y >= row1) return;
+    uint8_t &px = luma[y*width + x];
+    px = std::min(px + BOID_LUMA, 255);
+  }
+
+  const int width;
+  const int height;
+  const float lo;
+  const float scale;
+  Pool &pool;
+  const unsigned num_threads;
+  const int num_bands;
+  const int band_rows;
+
+  std::vector<uint8_t> luma;
+  std::vector<std::vector<uint32_t>> bins; // [thread][band]
+};
+
+
+class Y4MWriter {
+public:
+  // path "-" writes to stdout, so the video can be piped to an encoder
+  Y4MWriter(const std::string &path, int width, int height, int fps)
+    : width(width)
+    , height(height)
+    , chroma((width/2)*(height/2), 128) {
+    out = path == "-" ? stdout : std::fopen(path.c_str(), "wb");
+    if (out)
+      std::fprintf(out, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps);
+  }
+
+  Y4MWriter(const Y4MWriter &) = delete;
+
+  ~Y4MWriter() {
+    if (out && out != stdout) std::fclose(out);
+  }
+
+  bool good() const { return out != nullptr; }
+
+  bool write(const std::vector<uint8_t> &luma) {
+    // greyscale, so both chroma planes are flat
+    if (!out) return false;
+    std::fputs("FRAME\n", out);
+    std::fwrite(luma.data(), 1, width*height, out);
+    std::fwrite(chroma.data(), 1, chroma.size(), out);
+    std::fwrite(chroma.data(), 1, chroma.size(), out);
+    return !std::ferror(out);
+  }
+
+private:
+  const int width;
+  const int height;
+  std::vector<uint8_t> chroma;
+  std::FILE *out;
+};
+
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef __RENDERRING_H__
+#define __RENDERRING_H__
+
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+#include "glad/glad.h"
+
+#include "glm/glm.hpp"
+
+
+// Boid positions handed from the simulation straight to the GPU, without
+// going through a copy in the draw thread. One buffer, persistently and
+// coherently mapped, holds RING_SLOTS slots of positions. The simulation
+// writes a tick into a free slot and publishes it; the draw thread binds
+// the last two published slots as the previous and next position of each
+// boid and lets the vertex shader interpolate between them.
+//
+// Only the draw thread touches GL. It fences every frame, and a slot is
+// handed out for writing again only once every frame that read it has
+// passed its fence. The simulation never waits for that: with no slot
+// free, its tick is simply not shown.
+
+
+constexpr int RING_SLOTS = 5; // two shown, two published, one being written
+
+
+class PositionRing {
+public:
+  // draw thread, with the context current
+
+  bool create(uint32_t num_boids) {
+    // false without buffer storage, the caller keeps copying then
+    if (!GLAD_GL_VERSION_4_4 && !GLAD_GL_ARB_buffer_storage)
+      return false;
+
+    n = num_boids;
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferStorage(GL_ARRAY_BUFFER, slot_bytes()*RING_SLOTS, nullptr, flags);
+    mapped = static_cast<glm::vec2 *>(
+      glMapBufferRange(GL_ARRAY_BUFFER, 0, slot_bytes()*RING_SLOTS, flags));
+    if (!mapped) {
+      glDeleteBuffers(1, &buffer);
+      return false;
+    }
+
+    std::scoped_lock lock(mutex);
+    ready = true;
+    skipped = 0;
+    return true;
+  }
+
+  void destroy() {
+    {
+      std::scoped_lock lock(mutex);
+      ready = false;
+    }
+    for (auto &f: frames)
+      glDeleteSync(f.sync);
+    frames.clear();
+    if (mapped) {
+      glBindBuffer(GL_ARRAY_BUFFER, buffer);
+      glUnmapBuffer(GL_ARRAY_BUFFER);
+      glDeleteBuffers(1, &buffer);
+      mapped = nullptr;
+    }
+  }
+
+  GLuint get_buffer() const { return buffer; }
+
+  GLintptr slot_bytes() const { return sizeof(glm::vec2)*n; }
+
+  // simulation thread
+
+  bool up() {
+    // whether the draw thread reads positions from the ring
+    std::scoped_lock lock(mutex);
+    return ready;
+  }
+
+  glm::vec2 *acquire() {
+    // a slot to write the next tick into, nullptr if the ring isn't up
+    // or every slot is still being shown or read by the gpu
+    std::scoped_lock lock(mutex);
+    if (!ready)
+      return nullptr;
+    if ((writing = free_slot()) < 0) {
+      ++skipped;
+      return nullptr;
+    }
+    return mapped + writing*n;
+  }
+
+  uint64_t get_skipped() {
+    // ticks acquire() had no slot for, since create()
+    std::scoped_lock lock(mutex);
+    return skipped;
+  }
+
+  void publish() {
+    // the slot from acquire() is complete, coherent mapping makes it visible
+    std::scoped_lock lock(mutex);
+    if (writing < 0) return;
+    previous = latest;
+    latest = writing;
+    writing = -1;
+  }
+
+  // draw thread
+
+  bool begin_frame(GLintptr &prev_offset, GLintptr &next_offset) {
+    // offsets of the slots to draw this frame, false until there are two
+    retire();
+    std::scoped_lock lock(mutex);
+    if (previous < 0) return false;
+    shown_prev = previous;
+    shown_next = latest;
+    prev_offset = shown_prev*slot_bytes();
+    next_offset = shown_next*slot_bytes();
+    return true;
+  }
+
+  void end_frame() {
+    // after the draw call that read the shown slots
+    Frame f {glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), {shown_prev, shown_next}};
+    std::scoped_lock lock(mutex);
+    for (int s: f.slots)
+      ++inflight[s];
+    frames.push_back(f);
+  }
+
+private:
+  struct Frame {
+    GLsync sync;
+    std::array<int, 2> slots;
+  };
+
+  int free_slot() const {
+    // under the lock
+    for (int s = 0; s < RING_SLOTS; ++s) {
+      if (s == latest || s == previous || s == shown_prev || s == shown_next)
+        continue;
+      if (inflight[s] == 0)
+        return s;
+    }
+    return -1;
+  }
+
+  void retire() {
+    // drop the fences the gpu has passed, without waiting on any
+    while (!frames.empty()) {
+      GLenum status = glClientWaitSync(frames.front().sync, 0, 0);
+      if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        break;
+      glDeleteSync(frames.front().sync);
+      std::scoped_lock lock(mutex);
+      for (int s: frames.front().slots)
+        --inflight[s];
+      frames.pop_front();
+    }
+  }
+
+  std::mutex mutex;
+  bool ready = false;
+  uint64_t skipped = 0;
+
+  GLuint buffer = 0;
+  glm::vec2 *mapped = nullptr;
+  uint32_t n = 0;
+
+  // slot numbers, -1 for none, all under the mutex
+  int latest = -1;
+  int previous = -1;
+  int writing = -1;
+  int shown_prev = -1;
+  int shown_next = -1;
+  std::array<int, RING_SLOTS> inflight {}; // frames still reading each slot
+
+  std::deque<Frame> frames; // draw thread only
+};
+
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef __SDF_H__
+#define __SDF_H__
+
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+
+// Static obstacles, rasterized once into a signed distance field
+// so that avoidance costs one bilinear lookup per boid regardless
+// of how many obstacles there are.
+
+
+struct Obstacle {
+  enum Shape { CIRCLE, BOX };
+  Shape shape;
+  glm::vec2 center;
+  glm::vec2 size; // radius in .x for circles, half extents for boxes
+};
+
+
+inline float obstacle_distance(const Obstacle &o, glm::vec2 p) {
+  // exact signed distance, negative inside the obstacle
+  glm::vec2 d = p - o.center;
+  if (o.shape == Obstacle::CIRCLE) {
+    return glm::length(d) - o.size.x;
+  }
+  glm::vec2 q(std::abs(d.x) - o.size.x, std::abs(d.y) - o.size.y);
+  glm::vec2 outside(std::max(q.x, 0.0f), std::max(q.y, 0.0f));
+  return glm::length(outside) + std::min(std::max(q.x, q.y), 0.0f);
+}
+
+
+struct SDFSample {
+  float dist;
+  glm::vec2 grad; // unit (or zero), points away from the nearest obstacle
+};
+
+
+class SDF {
+public:
+  // covers [lo, hi] in both axes with res*res nodes
+  SDF(float lo, float hi, int res)
+    : lo(lo)
+    , res(res)
+    , step((hi - lo)/static_cast<float>(res - 1))
+    , dist(res*res, std::numeric_limits<float>::max())
+    , grad(res*res) {
+  }
+
+
+  void rasterize(const std::vector<Obstacle> &obstacles) {
+    // union of all obstacles is the min over their distances
+    for (int j = 0; j < res; ++j) {
+      for (int i = 0; i < res; ++i) {
+        glm::vec2 p = node(i, j);
+        float d = std::numeric_limits<float>::max();
+        for (auto &o: obstacles) {
+          d = std::min(d, obstacle_distance(o, p));
+        }
+        dist[j*res + i] = d;
+      }
+    }
+
+    // central differences, one sided at the border
+    for (int j = 0; j < res; ++j) {
+      for (int i = 0; i < res; ++i) {
+        int i0 = std::max(i - 1, 0), i1 = std::min(i + 1, res - 1);
+        int j0 = std::max(j - 1, 0), j1 = std::min(j + 1, res - 1);
+        glm::vec2 g((at(i1, j) - at(i0, j))/(step*(i1 - i0)),
+                    (at(i, j1) - at(i, j0))/(step*(j1 - j0)));
+        if (glm::dot(g, g) > 0.0f)
+          g = glm::normalize(g);
+        grad[j*res + i] = g;
+      }
+    }
+  }
+
+
+  SDFSample sample(glm::vec2 p) const {
+    // bilinear interpolation, positions outside the grid are clamped
+    float fx = std::clamp((p.x - lo)/step, 0.0f, static_cast<float>(res - 1));
+    float fy = std::clamp((p.y - lo)/step, 0.0f, static_cast<float>(res - 1));
+    int i = std::min(static_cast<int>(fx), res - 2);
+    int j = std::min(static_cast<int>(fy), res - 2);
+    float tx = fx - i;
+    float ty = fy - j;
+
+    int k = j*res + i;
+    float d = glm::mix(glm::mix(dist[k], dist[k + 1], tx),
+                       glm::mix(dist[k + res], dist[k + res + 1], tx), ty);
+    glm::vec2 g = glm::mix(glm::mix(grad[k], grad[k + 1], tx),
+                           glm::mix(grad[k + res], grad[k + res + 1], tx), ty);
+    // blending unit vectors shortens them, most where the nodes disagree
+    // (corners, between two obstacles); pushing out by dist along that
+    // would stop short and the bounce would be off
+    if (glm::dot(g, g) > 0.0f)
+      g = glm::normalize(g);
+    return SDFSample{d, g};
+  }
+
+
+private:
+  glm::vec2 node(int i, int j) const {
+    return glm::vec2(lo + i*step, lo + j*step);
+  }
+
+  float at(int i, int j) const { return dist[j*res + i]; }
+
+  const float lo;
+  const int res;
+  const float step;
+
+  std::vector<float> dist;
+  std::vector<glm::vec2> grad;
+};
+
+
+#endif
@@ -1,8 +1,18 @@
 #include <string>
 
-GLuint load_shaders() {
+GLuint load_shaders(bool interpolate = false) {
+  // interpolate: positions of the last two ticks come in as separate
+  // attributes and are mixed by the alpha uniform here, not on the cpu
 
-  std::string vertexCode = "#version 330 core\n"
+  std::string vertexCode = interpolate
+                         ? "#version 330 core\n"
+                           "layout (location = 0) in vec2 prev;\n"
+                           "layout (location = 1) in vec2 next;\n"
+                           "uniform float alpha;\n"
+                           "void main() {\n"
+                           "  gl_Position = vec4(mix(prev, next, alpha), 0.0, 1.0);\n"
+                           "}\n"
+                         : "#version 330 core\n"
                            "layout (location = 0) in vec3 pos;\n"
                            "void main() {\n"
                            "  gl_Position = vec4(pos.xy, 0.0, 1.0);\n"
@@ -0,0 +1,356 @@
+#ifndef __SHMSTATE_H__
+#define __SHMSTATE_H__
+
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "glm/glm.hpp"
+
+#include "sparsegrid.h"
+
+
+// Latest tick published through a POSIX shared memory segment, for other
+// processes to read without ever blocking the simulation.
+//
+// The writer unlinks the segment when it is destroyed. One that dies
+// without getting there leaves the segment behind; the next writer of
+// that name takes it over, and readers can tell from the pid in the
+// header whether anyone is still writing it. A segment whose writer is
+// still running is never taken over, the second writer just isn't good().
+//
+// The segment holds a header and two snapshot buffers. The writer always
+// fills the buffer that isn't current, bumping its sequence number to odd
+// before and back to even after, then flips current. A reader picks the
+// current buffer, reads, and retries if the sequence number was odd or
+// changed underneath it. Each snapshot carries a counting-sorted grid, so
+// readers can do neighbourhood queries without building their own. The
+// grid is a SparseGrid laid out flat: only occupied cells exist, found
+// through an open addressing table with SparseGrid's keys and hash, so it
+// covers the whole plane (an unbounded world included) in memory that
+// follows the capacity.
+//
+// Layout of a snapshot buffer (all little endian, 8 byte aligned):
+//   SnapshotHeader
+//   uint64_t keys[table]          packed (cx, cy) of every slot
+//   uint32_t values[table]        dense cell number of every slot, EMPTY if unused
+//   uint32_t cell_start[capacity + 1]   per dense cell, plus one past the end
+//   uint32_t sorted[capacity]     boid indices ordered by cell
+//   glm::vec2 pos[capacity]
+//   glm::vec2 vel[capacity]
+
+
+constexpr uint64_t SHM_MAGIC = 0x324d4853'44494f42; // "BOIDSHM2" in memory, 2 is the layout version
+constexpr uint64_t SHM_NO_TICK = UINT64_MAX; // the tick of a buffer nothing was published to yet
+
+
+struct ShmHeader {
+  uint64_t magic;
+  uint32_t capacity;
+  uint32_t table; // slots in the cell table, a power of two
+  float cell_size;
+  int32_t writer; // pid
+  uint64_t buffer_bytes;
+  std::atomic<uint32_t> current;
+  std::atomic<uint64_t> seq[2];
+};
+
+
+struct SnapshotHeader {
+  uint64_t tick;
+  uint32_t count;
+  uint32_t cells; // occupied
+};
+
+
+inline uint64_t align8(uint64_t n) { return (n + 7) & ~uint64_t(7); }
+
+
+class ShmSegment {
+public:
+  ~ShmSegment() {
+    if (base) munmap(base, bytes);
+  }
+
+  bool good() const { return base != nullptr; }
+
+protected:
+  static bool alive(int32_t pid) {
+    return kill(pid, 0) == 0 || errno == EPERM;
+  }
+
+  bool map(int fd, uint64_t size, int prot) {
+    void *p = mmap(nullptr, size, prot, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return false;
+    base = static_cast<uint8_t *>(p);
+    bytes = size;
+    return true;
+  }
+
+  ShmHeader *header() const { return reinterpret_cast<ShmHeader *>(base); }
+
+  uint8_t *buffer(uint32_t b) const {
+    return base + align8(sizeof(ShmHeader)) + b*header()->buffer_bytes;
+  }
+
+  // pointers into a buffer
+  SnapshotHeader *snap(uint32_t b) const {
+    return reinterpret_cast<SnapshotHeader *>(buffer(b));
+  }
+  uint64_t *keys(uint32_t b) const {
+    return reinterpret_cast<uint64_t *>(buffer(b) + align8(sizeof(SnapshotHeader)));
+  }
+  uint32_t *values(uint32_t b) const {
+    return reinterpret_cast<uint32_t *>(keys(b) + header()->table);
+  }
+  uint32_t *cell_start(uint32_t b) const {
+    return values(b) + align8(header()->table*sizeof(uint32_t))/sizeof(uint32_t);
+  }
+  uint32_t *sorted(uint32_t b) const {
+    uint32_t cells = header()->capacity + 1;
+    return cell_start(b) + align8(cells*sizeof(uint32_t))/sizeof(uint32_t);
+  }
+  glm::vec2 *pos(uint32_t b) const {
+    uint32_t cap = header()->capacity;
+    return reinterpret_cast<glm::vec2 *>(sorted(b) + align8(cap*sizeof(uint32_t))/sizeof(uint32_t));
+  }
+  glm::vec2 *vel(uint32_t b) const {
+    return pos(b) + header()->capacity;
+  }
+
+  int32_t coord(float v) const {
+    return static_cast<int32_t>(std::floor(v/header()->cell_size));
+  }
+
+  uint32_t probe(uint32_t b, uint64_t key) const {
+    // slot holding key, or the empty slot where it would go; table if
+    // a whole lap finds neither, which only a torn read can make happen
+    uint32_t mask = header()->table - 1;
+    uint32_t s = SparseGrid::mix(key) & mask;
+    for (uint32_t k = 0; k <= mask; ++k, s = (s + 1) & mask)
+      if (values(b)[s] == SparseGrid::EMPTY || keys(b)[s] == key)
+        return s;
+    return header()->table;
+  }
+
+  uint8_t *base = nullptr;
+  uint64_t bytes = 0;
+};
+
+
+class ShmWriter : public ShmSegment {
+public:
+  ShmWriter(const std::string &name, uint32_t capacity, float cell_size)
+    : name(name) {
+    // at most one cell per boid, so this keeps the load at or below 1/2
+    uint32_t table = 16;
+    while (table < 2*static_cast<uint64_t>(capacity))
+      table *= 2;
+    uint64_t buffer_bytes = align8(sizeof(SnapshotHeader))
+      + table*sizeof(uint64_t)
+      + align8(table*sizeof(uint32_t))
+      + align8((capacity + 1)*sizeof(uint32_t))
+      + align8(capacity*sizeof(uint32_t))
+      + 2*capacity*sizeof(glm::vec2);
+    uint64_t size = align8(sizeof(ShmHeader)) + 2*buffer_bytes;
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0) return;
+    if (held_elsewhere(fd)) {
+      close(fd);
+      return;
+    }
+    if (ftruncate(fd, size) != 0 || !map(fd, size, PROT_READ | PROT_WRITE)) {
+      if (base == nullptr) close(fd);
+      return;
+    }
+
+    auto h = header();
+    h->magic = 0; // not valid until the header is complete
+    h->capacity = capacity;
+    h->table = table;
+    h->cell_size = cell_size;
+    h->writer = getpid();
+    h->buffer_bytes = buffer_bytes;
+    h->current.store(0);
+    h->seq[0].store(0);
+    h->seq[1].store(0);
+    for (uint32_t b = 0; b < 2; ++b) {
+      snap(b)->tick = SHM_NO_TICK;
+      snap(b)->count = 0;
+      snap(b)->cells = 0;
+      std::fill(values(b), values(b) + table, SparseGrid::EMPTY);
+      cell_start(b)[0] = 0;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    h->magic = SHM_MAGIC;
+    cell.resize(capacity);
+    fill.resize(capacity);
+  }
+
+  ~ShmWriter() {
+    if (base) shm_unlink(name.c_str());
+  }
+
+  template <typename T>
+  void publish(uint64_t tick, const std::vector<T> &items) {
+    // items need position_of() and velocity_of() overloads
+    if (!base) return;
+    auto h = header();
+    uint32_t b = 1 - h->current.load(std::memory_order_relaxed);
+    uint32_t n = std::min<uint32_t>(items.size(), h->capacity);
+
+    h->seq[b].fetch_add(1, std::memory_order_relaxed); // odd, readers stay away
+    std::atomic_thread_fence(std::memory_order_release);
+
+    // the same counting sort as SparseGrid::build
+    snap(b)->tick = tick;
+    snap(b)->count = n;
+    uint32_t *start = cell_start(b);
+    std::fill(values(b), values(b) + h->table, SparseGrid::EMPTY);
+    uint32_t cells = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+      glm::vec2 p = position_of(items[i]);
+      pos(b)[i] = p;
+      vel(b)[i] = velocity_of(items[i]);
+      uint64_t key = SparseGrid::pack(coord(p.x), coord(p.y));
+      uint32_t s = probe(b, key);
+      if (values(b)[s] == SparseGrid::EMPTY) {
+        keys(b)[s] = key;
+        values(b)[s] = cells;
+        start[cells++] = 0;
+      }
+      cell[i] = values(b)[s];
+      ++start[cell[i]];
+    }
+    uint32_t total = 0;
+    for (uint32_t c = 0; c < cells; ++c) {
+      uint32_t count = start[c];
+      start[c] = total;
+      total += count;
+    }
+    start[cells] = total;
+    snap(b)->cells = cells;
+    std::copy(start, start + cells, fill.begin());
+    for (uint32_t i = 0; i < n; ++i)
+      sorted(b)[fill[cell[i]]++] = i;
+
+    h->seq[b].fetch_add(1, std::memory_order_release); // even again
+    h->current.store(b, std::memory_order_release);
+  }
+
+private:
+  static bool held_elsewhere(int fd) {
+    // whether fd is a complete segment another running writer still has
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < sizeof(ShmHeader))
+      return false;
+    void *p = mmap(nullptr, sizeof(ShmHeader), PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) return false;
+    auto h = static_cast<const ShmHeader *>(p);
+    bool held = h->magic == SHM_MAGIC && h->writer != getpid() && alive(h->writer);
+    munmap(p, sizeof(ShmHeader));
+    return held;
+  }
+
+  const std::string name;
+  std::vector<uint32_t> cell; // dense cell of every boid
+  std::vector<uint32_t> fill;
+};
+
+
+class ShmReader : public ShmSegment {
+public:
+  explicit ShmReader(const std::string &name) {
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < sizeof(ShmHeader)
+        || !map(fd, st.st_size, PROT_READ)) {
+      if (base == nullptr) close(fd);
+      return;
+    }
+    auto h = header();
+    if (h->magic != SHM_MAGIC
+        || bytes < align8(sizeof(ShmHeader)) + 2*h->buffer_bytes) {
+      munmap(base, bytes);
+      base = nullptr;
+    }
+  }
+
+  bool writer_alive() const {
+    // false for a segment left behind by a writer that died
+    return base && alive(header()->writer);
+  }
+
+  // both of these retry until they get a consistent view, and return the
+  // tick that view belongs to, SHM_NO_TICK before the first publish
+
+  uint64_t snapshot(std::vector<glm::vec2> &out_pos, std::vector<glm::vec2> &out_vel) const {
+    return consistent([&](uint32_t b) {
+      uint32_t n = snap(b)->count;
+      out_pos.assign(pos(b), pos(b) + n);
+      out_vel.assign(vel(b), vel(b) + n);
+    });
+  }
+
+  uint64_t query(glm::vec2 p, float radius, std::vector<uint32_t> &out) const {
+    // indices of all boids within radius of p
+    return consistent([&](uint32_t b) {
+      out.clear();
+      auto h = header();
+      int32_t x0 = coord(p.x - radius), x1 = coord(p.x + radius);
+      int32_t y0 = coord(p.y - radius), y1 = coord(p.y + radius);
+      for (int32_t y = y0; y <= y1; ++y) {
+        for (int32_t x = x0; x <= x1; ++x) {
+          uint32_t s = probe(b, SparseGrid::pack(x, y));
+          if (s == h->table || values(b)[s] == SparseGrid::EMPTY) continue;
+          // anything out of range is a torn read, the retry will catch it
+          uint32_t c = values(b)[s];
+          if (c >= h->capacity) continue;
+          uint32_t end = std::min(cell_start(b)[c + 1], h->capacity);
+          for (uint32_t k = cell_start(b)[c]; k < end; ++k) {
+            uint32_t i = sorted(b)[k];
+            if (i >= h->capacity) continue;
+            glm::vec2 d = pos(b)[i] - p;
+            if (glm::dot(d, d) < radius*radius)
+              out.push_back(i);
+          }
+        }
+      }
+    });
+  }
+
+private:
+  template <typename F>
+  uint64_t consistent(F &&read) const {
+    if (!base) return 0;
+    auto h = header();
+    while (true) {
+      uint32_t b = h->current.load(std::memory_order_acquire);
+      uint64_t s0 = h->seq[b].load(std::memory_order_acquire);
+      if (s0 & 1) continue;
+      uint64_t tick = snap(b)->tick;
+      read(b);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (h->seq[b].load(std::memory_order_relaxed) == s0)
+        return tick;
+    }
+  }
+};
+
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef __SPARSEGRID_H__
+#define __SPARSEGRID_H__
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+
+// Grid without bounds, for worlds where flocks can drift arbitrarily far
+// apart. Only occupied cells exist: an open addressing table maps a cell's
+// (cx, cy) to a dense cell number, and boid indices are counting-sorted by
+// that number into one flat array, like in Grid. The table is sized from
+// the boid count, so memory follows the number of boids (and hence of
+// occupied cells), not the extent of the world.
+//
+// build() takes a vector of anything with a position_of() overload.
+
+
+class SparseGrid {
+public:
+  explicit SparseGrid(float cell_size)
+    : cell_size(cell_size) {
+  }
+
+  template <typename T>
+  void build(const std::vector<T> &items) {
+    uint32_t n = items.size();
+
+    // at most one cell per boid, so this keeps the load at or below 1/2
+    size_t capacity = 16;
+    while (capacity < 2*static_cast<size_t>(n))
+      capacity *= 2;
+    keys.resize(capacity);
+    values.assign(capacity, EMPTY);
+    mask = capacity - 1;
+
+    cell.resize(n);
+    cell_start.clear();
+    cell_key.clear();
+    for (uint32_t i = 0; i < n; ++i) {
+      uint64_t key = key_of(position_of(items[i]));
+      size_t s = probe(key);
+      if (values[s] == EMPTY) {
+        keys[s] = key;
+        values[s] = cell_start.size();
+        cell_start.push_back(0);
+        cell_key.push_back(key);
+      }
+      cell[i] = values[s];
+      ++cell_start[cell[i]];
+    }
+
+    // counts to offsets, with one past the end
+    uint32_t total = 0;
+    for (auto &c: cell_start) {
+      uint32_t count = c;
+      c = total;
+      total += count;
+    }
+    cell_start.push_back(total);
+
+    fill.assign(cell_start.begin(), cell_start.end() - 1);
+    sorted.resize(n);
+    for (uint32_t i = 0; i < n; ++i)
+      sorted[fill[cell[i]]++] = i;
+  }
+
+  float get_cell_size() const { return cell_size; }
+  size_t occupied() const { return cell_start.empty() ? 0 : cell_start.size() - 1; }
+  uint32_t num_cells() const { return occupied(); }
+
+  uint32_t count_in(uint32_t c) const { return cell_start[c + 1] - cell_start[c]; }
+
+  template <typename F>
+  void for_each_in(uint32_t c, F &&fn) const {
+    // calls fn(index) for every boid in dense cell c
+    for (uint32_t k = cell_start[c]; k < cell_start[c + 1]; ++k)
+      fn(sorted[k]);
+  }
+
+  template <typename F>
+  void for_each_cell_near(uint32_t c, F &&fn) const {
+    // calls fn(cell) for dense cell c and the occupied cells around it
+    int32_t cx = static_cast<int32_t>(cell_key[c] >> 32);
+    int32_t cy = static_cast<int32_t>(static_cast<uint32_t>(cell_key[c]));
+    for (int32_t y = cy - 1; y <= cy + 1; ++y) {
+      for (int32_t x = cx - 1; x <= cx + 1; ++x) {
+        size_t s = probe(pack(x, y));
+        if (values[s] != EMPTY)
+          fn(values[s]);
+      }
+    }
+  }
+
+  template <typename F>
+  void for_each_near(glm::vec2 p, F &&fn) const {
+    // calls fn(index) for every boid in the 3x3 cells around p,
+    // the caller does the actual distance check
+    int32_t cx = coord(p.x), cy = coord(p.y);
+    for (int32_t y = cy - 1; y <= cy + 1; ++y)
+      for (int32_t x = cx - 1; x <= cx + 1; ++x)
+        visit(x, y, fn);
+  }
+
+  template <typename F>
+  void for_each_within(glm::vec2 p, float radius, F &&fn) const {
+    // every cell the square around p touches
+    int32_t x0 = coord(p.x - radius), x1 = coord(p.x + radius);
+    int32_t y0 = coord(p.y - radius), y1 = coord(p.y + radius);
+    for (int32_t y = y0; y <= y1; ++y)
+      for (int32_t x = x0; x <= x1; ++x)
+        visit(x, y, fn);
+  }
+
+  // cell keys and their hash, public since the shared memory snapshot
+  // (shmstate.h) lays its cells out the same way
+
+  static uint64_t pack(int32_t x, int32_t y) {
+    return static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32 | static_cast<uint32_t>(y);
+  }
+
+  static uint64_t mix(uint64_t k) {
+    // splitmix64 finalizer, neighbouring cells land far apart
+    k ^= k >> 30;
+    k *= 0xbf58476d1ce4e5b9;
+    k ^= k >> 27;
+    k *= 0x94d049bb133111eb;
+    k ^= k >> 31;
+    return k;
+  }
+
+  static constexpr uint32_t EMPTY = ~uint32_t(0);
+
+private:
+
+  int32_t coord(float v) const {
+    return static_cast<int32_t>(std::floor(v/cell_size));
+  }
+
+  uint64_t key_of(glm::vec2 p) const { return pack(coord(p.x), coord(p.y)); }
+
+  size_t probe(uint64_t key) const {
+    // slot holding key, or the empty slot where it would go
+    size_t s = mix(key) & mask;
+    while (values[s] != EMPTY && keys[s] != key)
+      s = (s + 1) & mask;
+    return s;
+  }
+
+  template <typename F>
+  void visit(int32_t x, int32_t y, F &fn) const {
+    if (keys.empty()) return;
+    size_t s = probe(pack(x, y));
+    if (values[s] == EMPTY) return;
+    uint32_t c = values[s];
+    for (uint32_t k = cell_start[c]; k < cell_start[c + 1]; ++k)
+      fn(sorted[k]);
+  }
+
+  const float cell_size;
+  size_t mask = 0;
+
+  std::vector<uint64_t> keys; // packed (cx, cy)
+  std::vector<uint32_t> values; // dense cell number of every key, EMPTY if unused
+  std::vector<uint32_t> cell_start; // per dense cell, plus one past the end
+  std::vector<uint64_t> cell_key; // packed (cx, cy) of every dense cell
+  std::vector<uint32_t> cell; // dense cell of every boid
+  std::vector<uint32_t> fill;
+  std::vector<uint32_t> sorted;
+};
+
+
+#endif
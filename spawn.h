@@ -0,0 +1,131 @@
+#ifndef __SPAWN_H__
+#define __SPAWN_H__
+
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+
+// Bulk spawning. Every boid draws its random numbers from a counter
+// based generator (Philox4x32-10) keyed by the seed and indexed by the
+// boid number, so boids can be generated in any order on any number of
+// threads and a seed always gives the same population.
+
+
+inline std::array<uint32_t, 4> philox(uint64_t seed, uint32_t index, uint32_t draw) {
+  constexpr uint32_t M0 = 0xD2511F53, M1 = 0xCD9E8D57;
+  constexpr uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85;
+
+  std::array<uint32_t, 4> c {index, draw, 0, 0};
+  uint32_t k0 = static_cast<uint32_t>(seed);
+  uint32_t k1 = static_cast<uint32_t>(seed >> 32);
+
+  for (int round = 0; round < 10; ++round) {
+    uint64_t p0 = static_cast<uint64_t>(M0)*c[0];
+    uint64_t p1 = static_cast<uint64_t>(M1)*c[2];
+    c = {static_cast<uint32_t>(p1 >> 32) ^ c[1] ^ k0, static_cast<uint32_t>(p1),
+         static_cast<uint32_t>(p0 >> 32) ^ c[3] ^ k1, static_cast<uint32_t>(p0)};
+    k0 += W0;
+    k1 += W1;
+  }
+  return c;
+}
+
+
+inline float to_unit(uint32_t x) {
+  // [0, 1) using the top 24 bits
+  return (x >> 8)*(1.0f/16777216.0f);
+}
+
+
+struct SpawnConfig {
+  enum Distribution { UNIFORM, NORMAL, CLUSTERED };
+  Distribution distribution = UNIFORM;
+  float sigma = 0.3f; // spread for NORMAL and around each CLUSTERED center
+  uint32_t clusters = 16;
+};
+
+
+struct Population {
+  std::vector<glm::vec2> pos;
+  std::vector<glm::vec2> vel; // unit length, scale by the boid speed
+};
+
+
+inline glm::vec2 uniform2(std::array<uint32_t, 4> r, int k) {
+  // two numbers in [-1, 1) from r[k], r[k + 1]
+  return glm::vec2(2.0f*to_unit(r[k]) - 1.0f, 2.0f*to_unit(r[k + 1]) - 1.0f);
+}
+
+
+inline glm::vec2 normal2(std::array<uint32_t, 4> r, int k) {
+  // Box-Muller, two standard normals from r[k], r[k + 1]
+  float u = 1.0f - to_unit(r[k]); // (0, 1] so the log is finite
+  float t = 6.2831853f*to_unit(r[k + 1]);
+  float m = std::sqrt(-2.0f*std::log(u));
+  return glm::vec2(m*std::cos(t), m*std::sin(t));
+}
+
+
+inline glm::vec2 direction(glm::vec2 v) {
+  return glm::dot(v, v) > 0.0f ? glm::normalize(v) : glm::vec2(1.0f, 0.0f);
+}
+
+
+inline void spawn_one(uint64_t seed, uint32_t i, const SpawnConfig &config,
+                      glm::vec2 &pos, glm::vec2 &vel) {
+  auto r = philox(seed, i, 0);
+  switch (config.distribution) {
+  case SpawnConfig::UNIFORM:
+    pos = uniform2(r, 0);
+    vel = direction(uniform2(r, 2));
+    break;
+  case SpawnConfig::NORMAL:
+    pos = glm::clamp(config.sigma*normal2(r, 0), -1.0f, 1.0f);
+    vel = direction(uniform2(r, 2));
+    break;
+  case SpawnConfig::CLUSTERED: {
+    // cluster centers and headings come from a separate draw,
+    // indexed by cluster instead of by boid
+    uint32_t c = i % std::max(config.clusters, 1u);
+    auto rc = philox(seed, c, 1);
+    glm::vec2 center = 0.8f*uniform2(rc, 0);
+    glm::vec2 heading = direction(uniform2(rc, 2));
+    pos = glm::clamp(center + config.sigma*normal2(r, 0), -1.0f, 1.0f);
+    vel = direction(heading + 0.25f*normal2(r, 2));
+    break;
+  }
+  }
+}
+
+
+inline Population spawn_population(uint64_t seed, uint32_t n, const SpawnConfig &config,
+                                   unsigned num_threads = std::thread::hardware_concurrency()) {
+  Population population;
+  population.pos.resize(n);
+  population.vel.resize(n);
+
+  num_threads = std::max(num_threads, 1u);
+  uint32_t chunk = (n + num_threads - 1)/num_threads;
+  std::vector<std::thread> threads;
+  for (uint32_t start = 0; start < n; start += chunk) {
+    threads.emplace_back([&, start] {
+      uint32_t end = std::min(start + chunk, n);
+      for (uint32_t i = start; i < end; ++i)
+        spawn_one(seed, i, config, population.pos[i], population.vel[i]);
+    });
+  }
+  for (auto &t: threads)
+    t.join();
+
+  return population;
+}
+
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+
+#include "glm/glm.hpp"
+
+#include "perthread.h"
+
+
+// Aggregate flock metrics, accumulated per thread from inside update_vel
+// (where velocity and neighbour count are already at hand) and reduced
+// once at the end of the tick, instead of a second pass over all boids.
+
+
+constexpr int DENSITY_BINS = 16;
+constexpr int DENSITY_BIN_WIDTH = 4; // neighbours per histogram bin
+
+
+struct TickStats {
+  int tick;
+  uint64_t boids;
+  double mean_speed;
+  double polarization; // |mean heading|, 1 when everyone is aligned
+  double mean_neighbours;
+  std::array<uint64_t, DENSITY_BINS> density; // histogram of neighbour counts
+};
+
+
+struct StatsAccumulator {
+  uint64_t count = 0;
+  uint64_t neighbours = 0;
+  double speed = 0.0;
+  glm::vec2 heading {0.0f, 0.0f};
+  std::array<uint64_t, DENSITY_BINS> density {};
+
+  void add(glm::vec2 vel, size_t num_neighbours) {
+    float s = glm::length(vel);
+    ++count;
+    neighbours += num_neighbours;
+    speed += s;
+    if (s > 0.0f)
+      heading += vel/s;
+    size_t bin = num_neighbours/DENSITY_BIN_WIDTH;
+    ++density[bin < DENSITY_BINS ? bin : DENSITY_BINS - 1];
+  }
+
+  void merge(const StatsAccumulator &o) {
+    count += o.count;
+    neighbours += o.neighbours;
+    speed += o.speed;
+    heading += o.heading;
+    for (int i = 0; i < DENSITY_BINS; ++i)
+      density[i] += o.density[i];
+  }
+};
+
+
+inline TickStats summarize(const StatsAccumulator &total, int tick) {
+  double n = total.count > 0 ? static_cast<double>(total.count) : 1.0;
+  return TickStats{tick, total.count, total.speed/n,
+                   glm::length(total.heading)/n, total.neighbours/n,
+                   total.density};
+}
+
+
+class FlockStats {
+public:
+  StatsAccumulator &local() {
+    // each thread gets its own accumulator
+    return accumulators.local();
+  }
+
+  TickStats reduce() {
+    // call after ecs.wait(), when no worker is accumulating
+    StatsAccumulator total;
+    accumulators.for_each([&](StatsAccumulator &acc) {
+      total.merge(acc);
+      acc = StatsAccumulator();
+    });
+
+    return summarize(total, tick++);
+  }
+
+private:
+  PerThread<StatsAccumulator> accumulators;
+  int tick = 0;
+};
+
+
+inline void write_header(std::ostream &out) {
+  out << "tick\tboids\tmean_speed\tpolarization\tmean_neighbours";
+  for (int i = 0; i < DENSITY_BINS; ++i)
+    out << "\tdensity_" << i*DENSITY_BIN_WIDTH;
+  out << '\n';
+}
+
+
+inline std::ostream &operator<<(std::ostream &out, const TickStats &s) {
+  out << s.tick << '\t' << s.boids << '\t' << s.mean_speed << '\t'
+      << s.polarization << '\t' << s.mean_neighbours;
+  for (auto d: s.density)
+    out << '\t' << d;
+  return out << '\n';
+}
+
+
+#endif
@@ -0,0 +1,81 @@
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "clusters.h"
+#include "stats.h"
+#include "world.h"
+
+
+// Headless parameter sweep. Runs many independent worlds in one process,
+// every worker thread pulls the next unfinished world from a shared
+// counter and runs it to completion, so cores stay busy even when each
+// world is too small to be worth splitting. One line per world is
+// printed as soon as it finishes.
+
+
+constexpr int SWEEP_BOIDS = 2048;
+constexpr int SWEEP_TICKS = 500;
+constexpr int SEEDS_PER_POINT = 4;
+
+const std::vector<float> SENSE_RADS {0.05, 0.1, 0.2};
+const std::vector<float> BOID_CENTERS {0.001, 0.002, 0.004};
+const std::vector<float> BOID_NEARS {0.01, 0.02, 0.04};
+const std::vector<float> BOID_STEERS {0.015, 0.03, 0.06};
+
+
+int main() {
+
+  std::vector<Params> runs;
+  for (auto sense_rad: SENSE_RADS)
+    for (auto center: BOID_CENTERS)
+      for (auto near: BOID_NEARS)
+        for (auto steer: BOID_STEERS)
+          for (int seed = 0; seed < SEEDS_PER_POINT; ++seed)
+            runs.push_back(Params{sense_rad, center, near, steer,
+                                  static_cast<uint64_t>(seed)});
+
+  std::cout << "sense_rad\tcenter\tnear\tsteer\tseed"
+            << "\tpolarization\tmean_neighbours\tflocks\tlargest" << std::endl;
+
+  std::atomic<size_t> next {0};
+  std::mutex out_mutex;
+
+  auto worker = [&] {
+    Pool pool(1); // runs are already spread over the threads
+    for (size_t r = next++; r < runs.size(); r = next++) {
+      World world(runs[r], SWEEP_BOIDS);
+      for (int t = 0; t < SWEEP_TICKS - 1; ++t)
+        world.tick();
+
+      // only the last tick is measured
+      StatsAccumulator acc;
+      world.tick(&acc);
+      auto stats = summarize(acc, SWEEP_TICKS - 1);
+
+      auto flocks = find_clusters(world.pos, world.vel, world.p.sense_rad, pool);
+      uint32_t largest = 0;
+      for (auto &cl: flocks.clusters)
+        largest = std::max(largest, cl.size);
+
+      auto &p = world.p;
+      std::scoped_lock lock(out_mutex);
+      std::cout << p.sense_rad << '\t' << p.center << '\t' << p.near << '\t'
+                << p.steer << '\t' << p.seed << '\t' << stats.polarization << '\t'
+                << stats.mean_neighbours << '\t' << flocks.clusters.size() << '\t'
+                << largest << std::endl;
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < std::max(std::thread::hardware_concurrency(), 1u); ++i)
+    threads.emplace_back(worker);
+  for (auto &t: threads)
+    t.join();
+
+  return 0;
+}
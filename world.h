@@ -0,0 +1,299 @@
+#ifndef __WORLD_H__
+#define __WORLD_H__
+
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "grid.h"
+#include "multirate.h"
+#include "pool.h"
+#include "pyramid.h"
+#include "spawn.h"
+#include "stats.h"
+
+
+// A self contained flock for the headless programs, outside of the ecs
+// and with its own parameters. Same steering rules as update_vel in the
+// ecs mains, minus obstacles.
+//
+// With a region of interest set, only boids inside it get the full rules.
+// The rest steer towards the mean position and velocity of their grid
+// cell, which costs the same for any density. A boid is promoted on
+// entering the region, but only demoted once it is margin beyond it, so
+// boids on the border don't flicker between the two.
+//
+// With multi rate set, the full rules are the ones of MULTI_RATE in
+// boids3 (multirate.h), so the two can be compared on the same flock.
+
+
+constexpr float WORLD_BOID_VEL = 0.05;
+
+
+struct Params {
+  float sense_rad;
+  float center;
+  float near;
+  float steer;
+  uint64_t seed;
+};
+
+
+struct Roi {
+  glm::vec2 center;
+  float radius;
+  float margin; // hysteresis, demoted only beyond radius + margin
+};
+
+
+struct LodReport {
+  uint32_t full = 0;
+  uint32_t reduced = 0;
+  uint32_t promoted = 0;
+  uint32_t demoted = 0;
+  double full_time = 0.0; // seconds spent in each model this tick
+  double reduced_time = 0.0;
+};
+
+
+class World {
+public:
+  World(const Params &p, uint32_t n, const SpawnConfig &spawn = SpawnConfig())
+    : p(p)
+    , grid(-1.0f, 1.0f, p.sense_rad) {
+    auto population = spawn_population(p.seed, n, spawn, 1);
+    pos = std::move(population.pos);
+    vel = std::move(population.vel);
+    for (auto &v: vel)
+      v *= WORLD_BOID_VEL;
+    next_vel.resize(vel.size());
+    full.assign(pos.size(), 1);
+    field.resize(grid.get_dim()*grid.get_dim());
+  }
+
+  void set_roi(const Roi &r) {
+    roi = r;
+    use_roi = true;
+  }
+
+  void clear_roi() {
+    use_roi = false;
+  }
+
+  void set_multi_rate(float near_rad, uint32_t every) {
+    // cohesion and alignment refreshed every this many ticks, separation
+    // live within near_rad only
+    multi_near_rad = near_rad;
+    multi_every = every;
+    slow.clear();
+    for (uint32_t i = 0; i < pos.size(); ++i)
+      slow.push_back(make_slow_steer(pos[i], vel[i], i % every));
+  }
+
+  const LodReport &get_lod_report() const { return report; }
+
+  void tick(StatsAccumulator *stats = nullptr, Pool *pool = nullptr) {
+    // on the calling thread alone without a pool
+    grid.build(pos);
+    update_lod();
+
+    // velocities go to next_vel, so every thread sees last tick's
+    auto start = std::chrono::steady_clock::now();
+    parallel(full_ids, stats, pool, [&](uint32_t i, StatsAccumulator *acc) {
+      if (multi_every > 0)
+        update_multi_rate(i, acc);
+      else
+        update_full(i, acc);
+    });
+    auto mid = std::chrono::steady_clock::now();
+    if (!reduced_ids.empty()) {
+      build_field();
+      parallel(reduced_ids, stats, pool, [&](uint32_t i, StatsAccumulator *acc) {
+        update_reduced(i, acc);
+      });
+    }
+    auto end = std::chrono::steady_clock::now();
+    report.full_time = std::chrono::duration<double>(mid - start).count();
+    report.reduced_time = std::chrono::duration<double>(end - mid).count();
+    std::swap(vel, next_vel);
+
+    for (size_t i = 0; i < pos.size(); ++i)
+      move(pos[i], vel[i]);
+    ++ticks;
+  }
+
+  const Params p;
+  std::vector<glm::vec2> pos;
+  std::vector<glm::vec2> vel;
+
+private:
+  void update_lod() {
+    // sort boids into the two models, with hysteresis at the border
+    report = LodReport();
+    full_ids.clear();
+    reduced_ids.clear();
+    if (full.size() != pos.size())
+      full.assign(pos.size(), 1);
+    float inner = roi.radius*roi.radius;
+    float outer = (roi.radius + roi.margin)*(roi.radius + roi.margin);
+    for (uint32_t i = 0; i < pos.size(); ++i) {
+      if (use_roi) {
+        glm::vec2 d = pos[i] - roi.center;
+        float d2 = glm::dot(d, d);
+        if (!full[i] && d2 < inner) {
+          full[i] = 1;
+          ++report.promoted;
+        } else if (full[i] && d2 > outer) {
+          full[i] = 0;
+          ++report.demoted;
+        }
+      } else if (!full[i]) {
+        full[i] = 1;
+        ++report.promoted;
+      }
+      (full[i] ? full_ids : reduced_ids).push_back(i);
+    }
+    report.full = full_ids.size();
+    report.reduced = reduced_ids.size();
+  }
+
+  void build_field() {
+    // per cell sums of everyone, reduced boids read their own cell
+    std::fill(field.begin(), field.end(), Aggregate());
+    for (uint32_t i = 0; i < pos.size(); ++i) {
+      auto &a = field[grid.cell_of(pos[i])];
+      ++a.count;
+      a.pos += pos[i];
+      a.vel += vel[i];
+    }
+  }
+
+  template <typename F>
+  void parallel(const std::vector<uint32_t> &ids, StatsAccumulator *stats,
+                Pool *pool, F &&fn) {
+    if (!pool || pool->size() == 1) {
+      for (uint32_t i: ids)
+        fn(i, stats);
+      return;
+    }
+    unsigned num_threads = pool->size();
+    accs.assign(num_threads, StatsAccumulator());
+    size_t chunk = (ids.size() + num_threads - 1)/num_threads;
+    pool->run([&](unsigned t) {
+      size_t start = std::min(t*chunk, ids.size());
+      size_t end = std::min(start + chunk, ids.size());
+      for (size_t k = start; k < end; ++k)
+        fn(ids[k], stats ? &accs[t] : nullptr);
+    });
+    if (stats)
+      for (auto &acc: accs)
+        stats->merge(acc);
+  }
+
+  void update_full(uint32_t i, StatsAccumulator *stats) {
+    float r2 = p.sense_rad*p.sense_rad;
+    glm::vec2 center(0.0f);
+    glm::vec2 near(0.0f);
+    glm::vec2 steer(0.0f);
+    size_t count = 0;
+    grid.for_each_near(pos[i], [&](uint32_t j) {
+      glm::vec2 d = pos[j] - pos[i];
+      if (glm::dot(d, d) >= r2) return;
+      center += pos[j];
+      near -= d;
+      steer += vel[j];
+      ++count;
+    });
+    center = center - static_cast<float>(count)*pos[i];
+    apply_steering(i, center, near, steer, count, stats);
+  }
+
+  void update_multi_rate(uint32_t i, StatsAccumulator *stats) {
+    auto s = multi_rate_steering(slow[i], i, pos[i], vel[i], ticks, multi_every,
+                                 p.sense_rad, multi_near_rad, [&](float radius, auto &&fn) {
+      grid.for_each_within(pos[i], radius, [&](uint32_t j) {
+        fn(j, pos[j], vel[j]);
+      });
+    });
+    apply_steering(i, s.center, s.near, s.steer, s.count, stats);
+  }
+
+  void apply_steering(uint32_t i, glm::vec2 center, glm::vec2 near, glm::vec2 steer,
+                      size_t count, StatsAccumulator *stats) {
+    if (glm::length(center) > 0.0f)
+      center = glm::normalize(center);
+    if (glm::length(near) > 0.0f)
+      near = glm::normalize(near);
+    if (glm::length(steer) > 0.0f)
+      steer = glm::normalize(steer);
+
+    next_vel[i] = WORLD_BOID_VEL*glm::normalize(vel[i] +
+                                                p.center*center +
+                                                p.near*near +
+                                                p.steer*steer);
+    if (stats)
+      stats->add(next_vel[i], count - 1); // count includes boid i
+  }
+
+  void update_reduced(uint32_t i, StatsAccumulator *stats) {
+    // cohesion and alignment with the cell as a whole, no separation
+    const Aggregate &a = field[grid.cell_of(pos[i])];
+    glm::vec2 center = a.pos - static_cast<float>(a.count)*pos[i];
+    glm::vec2 steer = a.vel;
+
+    if (glm::length(center) > 0.0f)
+      center = glm::normalize(center);
+    if (glm::length(steer) > 0.0f)
+      steer = glm::normalize(steer);
+
+    next_vel[i] = WORLD_BOID_VEL*glm::normalize(vel[i] +
+                                                p.center*center +
+                                                p.steer*steer);
+    if (stats)
+      stats->add(next_vel[i], a.count - 1); // whole cell, a rough neighbour count
+  }
+
+  static void move(glm::vec2 &pos, glm::vec2 &vel) {
+    pos += vel;
+    if (pos.x < -1.0f) {
+      pos.x = -2.0f - pos.x;
+      vel.x = -vel.x;
+    }
+    if (pos.y < -1.0f) {
+      pos.y = -2.0f - pos.y;
+      vel.y = -vel.y;
+    }
+    if (pos.x > 1.0f) {
+      pos.x = 2.0f - pos.x;
+      vel.x = -vel.x;
+    }
+    if (pos.y > 1.0f) {
+      pos.y = 2.0f - pos.y;
+      vel.y = -vel.y;
+    }
+  }
+
+  Grid grid;
+  std::vector<glm::vec2> next_vel;
+  std::vector<StatsAccumulator> accs; // one per pool thread
+
+  Roi roi {};
+  bool use_roi = false;
+  std::vector<uint8_t> full; // 1 if the boid gets the full rules
+  std::vector<uint32_t> full_ids;
+  std::vector<uint32_t> reduced_ids;
+  std::vector<Aggregate> field;
+  LodReport report;
+
+  uint32_t ticks = 0;
+  uint32_t multi_every = 0; // 0 for the full rules every tick
+  float multi_near_rad = 0.0f;
+  std::vector<SlowSteer> slow;
+};
+
+
+#endif